@@ -1,10 +1,10 @@
 #ifndef ICOMPONENT_H
 #define ICOMPONENT_H
 
-#include "disposable.h"
+#include <cstdint>
 
 class GameObject;
-class Component : Disposable
+class Component
 {
 public:
     virtual ~Component();
@@ -13,7 +13,9 @@ protected:
     explicit Component();
 
 private:
-    virtual void Do(GameObject *) = 0;
+    // Adds the component to or drops it from the pool of its type
+    virtual void Attach(uint32_t) = 0;
+    virtual void Detach(uint32_t) = 0;
 
     friend class GameObject;
 };
@@ -0,0 +1,34 @@
+#ifndef IPOOLED_H
+#define IPOOLED_H
+
+#include "resourcepool.h"
+
+// Base of the objects owned by ResourcePool<T>
+template<typename T>
+class Pooled
+{
+public:
+    Handle<T> GetHandle() const
+    {
+        return handle;
+    }
+
+protected:
+    explicit Pooled()
+        : handle(ResourcePool<T>::Insert(static_cast<T *>(this)))
+    {
+    }
+
+    ~Pooled()
+    {
+        ResourcePool<T>::Erase(handle);
+    }
+
+private:
+    Handle<T> handle;
+
+    Pooled(const Pooled &) = delete;
+    Pooled &operator=(const Pooled &) = delete;
+};
+
+#endif // IPOOLED_H
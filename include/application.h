@@ -3,15 +3,21 @@
 
 #include <glm/glm.hpp>
 
+class BVH;
 class Camera;
+class DynamicResolution;
+class OcclusionBuffer;
 class Application
 {
 public:
     explicit Application(const char *, int = 800, int = 600, float = .15f, float = 30.f);
     ~Application();
 
+    static BVH *GetBVH();
     static const Camera *GetCamera();
     static double GetDeltaTime();
+    static DynamicResolution *GetDynamicResolution();
+    static OcclusionBuffer *GetOcclusionBuffer();
     static glm::mat4 GetProjectionMatrix();
 
     int exec();
@@ -0,0 +1,240 @@
+#ifndef ASSETMANAGER_H
+#define ASSETMANAGER_H
+
+#include "resourcepool.h"
+#include "threadpool.h"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+enum class AssetState
+{
+    Pending,   // Waiting for a loader or being loaded
+    Ready,     // Loaded into memory, waiting for the upload
+    Resident,  // Uploaded, the object exists
+    Failed,
+    Cancelled
+};
+
+class AssetManager;
+// Request for an object built in two steps, loading on the thread pool and
+// uploading on the main thread
+class AssetBase
+{
+public:
+    virtual ~AssetBase();
+
+    AssetState GetState() const;
+    // Resident, failed or cancelled
+    bool IsDone() const;
+
+    int GetPriority() const;
+    // Higher first, both for loading and uploading
+    void SetPriority(int);
+    // Takes effect on the next update, unless the asset is resident by then
+    void Cancel();
+
+protected:
+    std::atomic<AssetState> state;
+    std::atomic<int> priority;
+    std::atomic<bool> cancelled;
+    // Uploaded only once all of them are resident, failing with any of them
+    std::vector<std::shared_ptr<AssetBase>> dependencies;
+
+    explicit AssetBase(const std::vector<std::shared_ptr<AssetBase>> &, int);
+
+    virtual void Load() = 0;
+    virtual void Upload() = 0;
+    virtual void Complete(AssetState) = 0;
+
+private:
+    AssetBase(const AssetBase &) = delete;
+    AssetBase &operator=(const AssetBase &) = delete;
+
+    friend class AssetManager;
+};
+
+template<typename T>
+class Asset : public AssetBase
+{
+public:
+    // nullptr until resident, or once the object is deleted
+    T *Get() const
+    {
+        return ResourcePool<T>::Get(handle);
+    }
+
+    T *GetOr(T *placeholder) const
+    {
+        auto object = Get();
+        return object ? object : placeholder;
+    }
+
+    // Resolves to the object, or to nullptr when the asset fails or is
+    // cancelled. Uploads happen on the main thread, which must not wait.
+    std::shared_future<T *> GetFuture() const
+    {
+        return future;
+    }
+
+    // Runs on the main thread once the asset is done, with nullptr when it
+    // failed or was cancelled. Runs right away if it already is done.
+    void OnComplete(const std::function<void(T *)> &callback)
+    {
+        if (IsDone())
+        {
+            callback(Get());
+            return;
+        }
+
+        callbacks.push_back(callback);
+    }
+
+protected:
+    Handle<T> handle;
+
+    explicit Asset(const std::vector<std::shared_ptr<AssetBase>> &dependencies, int priority)
+        : AssetBase(dependencies, priority)
+        , future(promise.get_future().share())
+        , completed(false)
+    {
+    }
+
+    void Complete(AssetState result)
+    {
+        if (completed)
+        {
+            return;
+        }
+
+        completed = true;
+        state = result;
+
+        auto object = Get();
+        promise.set_value(object);
+
+        for (const auto &callback : callbacks)
+        {
+            callback(object);
+        }
+
+        callbacks.clear();
+    }
+
+private:
+    std::promise<T *> promise;
+    std::shared_future<T *> future;
+    std::vector<std::function<void(T *)>> callbacks;
+    bool completed;
+};
+
+template<typename T>
+using AssetHandle = std::shared_ptr<Asset<T>>;
+
+// Loads assets in the background and uploads them a few at a time, so that
+// the frame loop keeps running with placeholders meanwhile
+class AssetManager
+{
+public:
+    // Seconds of uploads per update, at least one upload happens
+    static constexpr double UploadBudget = .002;
+
+    // The first function runs on the thread pool and produces the data,
+    // the second one turns it into the object on the main thread. Either
+    // one throwing fails the asset.
+    template<typename T, typename Data>
+    static AssetHandle<T> Request(const std::function<Data()> &load,
+                                  const std::function<T *(Data &)> &upload,
+                                  const std::vector<std::shared_ptr<AssetBase>> &dependencies = {},
+                                  int priority = 0)
+    {
+        std::shared_ptr<Asset<T>> asset(new LoadedAsset<T, Data>(load, upload, dependencies, priority));
+
+        std::lock_guard<std::mutex> lock(requestsMutex);
+        queued.push_back(asset);
+
+        return asset;
+    }
+
+    // Called by the main thread once per frame, starts loads, uploads and
+    // runs completion callbacks
+    static void Update();
+    // Cancels every request and waits for the loads in progress
+    static void Clear();
+
+    static size_t GetPendingCount();
+
+private:
+    template<typename T, typename Data>
+    class LoadedAsset : public Asset<T>
+    {
+    public:
+        explicit LoadedAsset(const std::function<Data()> &load,
+                             const std::function<T *(Data &)> &upload,
+                             const std::vector<std::shared_ptr<AssetBase>> &dependencies,
+                             int priority)
+            : Asset<T>(dependencies, priority)
+            , load(load)
+            , upload(upload)
+        {
+        }
+
+    private:
+        std::function<Data()> load;
+        std::function<T *(Data &)> upload;
+        Data data;
+
+        void Load()
+        {
+            try
+            {
+                data = load();
+                this->state = AssetState::Ready;
+            }
+            catch (...)
+            {
+                this->state = AssetState::Failed;
+            }
+
+            // Whatever the loader holds on to is not needed anymore
+            load = nullptr;
+        }
+
+        void Upload()
+        {
+            try
+            {
+                auto object = upload(data);
+
+                if (object)
+                {
+                    this->handle = object->GetHandle();
+                }
+
+                this->state = object ? AssetState::Resident : AssetState::Failed;
+            }
+            catch (...)
+            {
+                this->state = AssetState::Failed;
+            }
+
+            data = Data();
+            upload = nullptr;
+        }
+    };
+    static std::mutex requestsMutex;
+    // Waiting for a loader, and loaded ones waiting for their upload
+    static std::vector<std::shared_ptr<AssetBase>> queued;
+    static std::vector<std::shared_ptr<AssetBase>> loaded;
+    static size_t loading;
+    static JobCounter loads;
+
+    static void Start(const std::shared_ptr<AssetBase> &);
+};
+
+#endif // ASSETMANAGER_H
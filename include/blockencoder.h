@@ -0,0 +1,57 @@
+#ifndef BLOCKENCODER_H
+#define BLOCKENCODER_H
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+
+enum class CompressionQuality
+{
+    Fast,   // Bounding box endpoints
+    Normal, // Principal axis endpoints
+    High    // Principal axis endpoints refined by least squares
+};
+
+struct EncoderStats
+{
+    uintmax_t blocks;
+    double seconds;
+};
+
+enum class TextureFormat;
+
+// Encodes RGBA32 images into 4x4 block compressed formats, rows of blocks
+// are spread over the thread pool
+class BlockEncoder
+{
+public:
+    static void Encode(const uint8_t *, uint32_t, uint32_t, TextureFormat, CompressionQuality, uint8_t *);
+    static size_t GetBlockSize(TextureFormat);
+
+    // Totals over every image encoded so far, for throughput figures
+    static EncoderStats GetStats();
+
+private:
+    struct Block
+    {
+        // Planar red, green, blue and alpha
+        alignas(16) float channel[4][16];
+    };
+    static EncoderStats stats;
+
+    static void Fetch(const uint8_t *, uint32_t, uint32_t, uint32_t, uint32_t, Block &);
+
+    static void EncodeColor(const Block &, CompressionQuality, uint8_t *);
+    static void EncodeExplicitAlpha(const Block &, uint8_t *);
+    static void EncodeInterpolatedAlpha(const Block &, uint8_t *);
+
+    static void GetBoundingBox(const Block &, glm::vec3 &, glm::vec3 &);
+    static void GetPrincipalAxis(const Block &, glm::vec3 &, glm::vec3 &);
+    static bool Refine(const Block &, const uint8_t *, glm::vec3 &, glm::vec3 &);
+    static float SelectIndices(const Block &, const glm::vec3 &, const glm::vec3 &, uint8_t *);
+
+    static uint16_t To565(const glm::vec3 &);
+    static glm::vec3 From565(uint16_t);
+};
+
+#endif // BLOCKENCODER_H
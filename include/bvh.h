@@ -0,0 +1,60 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class Frustum;
+// Dynamic bounding volume hierarchy over axis aligned boxes, each one
+// identified by a caller supplied id. Leaves hold slightly enlarged boxes,
+// so small movements need no change at all and larger ones reinsert the
+// leaf where it adds the least surface area.
+class BVH
+{
+public:
+    static constexpr uint32_t None = 0xFFFFFFFF;
+
+    explicit BVH();
+
+    bool Contains(uint32_t) const;
+    size_t GetSize() const;
+
+    // Inserts the item if it is not in the tree yet
+    void Update(uint32_t, const glm::vec3 &, const glm::vec3 &);
+    void Remove(uint32_t);
+    // Rebuilds the whole tree with binned SAH splits
+    void Rebuild();
+    void Clear();
+
+    // Append the ids of the items whose boxes may intersect the volume.
+    // The enlarged boxes are tested, so items just outside may be included.
+    void QueryFrustum(const Frustum &, std::vector<uint32_t> &) const;
+    void QueryRadius(const glm::vec3 &, float, std::vector<uint32_t> &) const;
+    void QueryRay(const glm::vec3 &, const glm::vec3 &, float, std::vector<uint32_t> &) const;
+    // Item whose enlarged box the ray enters first, None if there is none
+    uint32_t Raycast(const glm::vec3 &, const glm::vec3 &, float, float &) const;
+
+private:
+    struct Node
+    {
+        glm::vec3 mins, maxs;
+        uint32_t parent;
+        uint32_t children[2];
+        uint32_t id;  // None for inner nodes
+    };
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeNodes;
+    std::vector<uint32_t> leaves;  // Leaf of each id
+    uint32_t root;
+    size_t size;
+
+    uint32_t AllocateNode();
+    void FreeNode(uint32_t);
+    void InsertLeaf(uint32_t);
+    void RemoveLeaf(uint32_t);
+    void Refit(uint32_t);
+    uint32_t Build(uint32_t *, size_t);
+};
+
+#endif // BVH_H
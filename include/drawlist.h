@@ -0,0 +1,50 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "frustum.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+class Material;
+class Mesh;
+
+struct DrawPacket
+{
+    // Material in the upper half, view depth in the lower half,
+    // so that state changes are minimized and draws go front to back
+    uint64_t key;
+    const Material *material;
+    const Mesh *mesh;
+    glm::mat4 model;
+};
+
+class DrawList
+{
+public:
+    explicit DrawList();
+
+    // Culls the entities having a mesh and a material against the frustum
+    // and the occlusion buffer, and builds their packets on the worker threads
+    void Build(const glm::mat4 &);
+    // Issues the GL calls, must be called from the thread owning the context
+    void Submit() const;
+
+    size_t GetSize() const;
+    // Meshes left out by frustum culling in the last Build. Meshes without
+    // a material are never drawn and only count when the BVH rejects them.
+    size_t GetCulledCount() const;
+
+private:
+    // Entities from the scene tree, their world bounds, and the indices
+    // of the ones inside the frustum
+    std::vector<uint32_t> candidates;
+    BoxArrays bounds;
+    std::vector<uint32_t> visible;
+    size_t culled;
+    std::vector<std::vector<DrawPacket>> slices;
+    std::vector<DrawPacket> packets;
+};
+
+#endif // DRAWLIST_H
@@ -0,0 +1,37 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <cstdint>
+
+// Offscreen render target whose resolution follows a frame time target.
+// The scene is drawn into a scaled part of it and stretched to the window.
+class DynamicResolution
+{
+public:
+    explicit DynamicResolution(double = 1. / 60., float = .5f, float = 1.f);
+    ~DynamicResolution();
+
+    void Resize(int, int);
+    void Begin();
+    void End();
+
+    float GetScale() const;
+    void SetTargetFrameTime(double);
+
+private:
+    static constexpr int Latency = 3;
+
+    uint32_t fbo, color, depth;
+    uint32_t queries[Latency];
+    uint32_t frame;
+    int width, height;
+    int scaledWidth, scaledHeight;
+    double targetFrameTime;
+    double frameTime;
+    float minScale, maxScale;
+    float scale;
+
+    void Update(double);
+};
+
+#endif // DYNAMICRESOLUTION_H
@@ -0,0 +1,61 @@
+#ifndef FRAMEALLOCATOR_H
+#define FRAMEALLOCATOR_H
+
+#include "lineararena.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Scratch memory for the frame loop. Every thread bumps its own arena, and
+// each thread has one arena per frame in flight, so memory handed out
+// during a frame stays valid until FramesInFlight frames later. Arenas keep
+// their blocks across frames, a frame needing no more than the previous
+// ones does not reach the heap.
+class FrameAllocator
+{
+public:
+    static constexpr uint32_t FramesInFlight = 3;
+
+    // Called by the main thread between frames, while no other thread
+    // allocates
+    static void BeginFrame();
+
+    static void *Allocate(size_t, size_t);
+
+    // Allocates from the arena of the calling thread, containers using it
+    // are meant to stay on that thread
+    template<typename T>
+    static LinearAllocator<T> GetAllocator()
+    {
+        return LinearAllocator<T>(GetArena());
+    }
+
+    // Heap blocks taken by every thread during the last frame, zero in
+    // steady state
+    static uintmax_t GetHeapAllocations();
+
+    // Frees the memory of every thread
+    static void Clear();
+
+private:
+    struct ThreadArenas
+    {
+        LinearArena arenas[FramesInFlight];
+        // Largest use and heap blocks taken so far by each arena
+        size_t peaks[FramesInFlight];
+        uintmax_t blocks[FramesInFlight];
+
+        explicit ThreadArenas();
+        ~ThreadArenas();
+    };
+    static std::vector<ThreadArenas *> threads;
+    static std::mutex threadsMutex;
+    static uint32_t frame;
+    static uintmax_t heapAllocations;
+
+    static LinearArena &GetArena();
+};
+
+#endif // FRAMEALLOCATOR_H
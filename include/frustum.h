@@ -0,0 +1,43 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+enum class Containment
+{
+    Outside,
+    Intersecting,
+    Inside
+};
+
+// Axis aligned boxes with each coordinate in its own array, so that the
+// culling kernel tests several boxes per instruction
+struct BoxArrays
+{
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+    void Resize(size_t);
+    void Set(size_t, const glm::vec3 &, const glm::vec3 &);
+    void Get(size_t, glm::vec3 &, glm::vec3 &) const;
+    size_t GetSize() const;
+};
+
+// The six clip planes of a view-projection matrix, pointing inwards
+class Frustum
+{
+public:
+    explicit Frustum(const glm::mat4 &);
+
+    Containment Classify(const glm::vec3 &, const glm::vec3 &) const;
+    // Writes the indices of the boxes that are not entirely outside,
+    // in order, and returns how many there are
+    size_t Cull(const BoxArrays &, uint32_t *) const;
+
+private:
+    glm::vec4 planes[6];
+};
+
+#endif // FRUSTUM_H
@@ -1,18 +1,13 @@
 #ifndef GAMEOBJECT_H
 #define GAMEOBJECT_H
 
-#include "abstract/disposable.h"
+#include "abstract/pooled.h"
 
 #include <glm/glm.hpp>
 
-#include <vector>
-
-class Application;
 class Component;
-class GameObject : Disposable
+class GameObject : public Pooled<GameObject>
 {
-    static std::vector<GameObject *> instances;
-
 public:
     explicit GameObject();
     ~GameObject();
@@ -20,7 +15,8 @@ public:
     void AddComponent(Component *);
     void RemoveComponent(Component *);
 
-    glm::mat4 GetModelMatrix();
+    bool GetBounds(glm::vec3 &, glm::vec3 &) const;
+    const glm::mat4 &GetModelMatrix() const;
 
     void SetParent(const GameObject *);
     void SetPosition(const glm::vec3 &);
@@ -28,19 +24,9 @@ public:
     void SetScale(const glm::vec3 &);
 
 private:
-    const GameObject *parent;
-    glm::mat4 model;
-    glm::mat4 mat_position;
-    glm::mat4 mat_rotation;
-    glm::mat4 mat_scale;
-    Component *materialComponent;
-    Component *meshComponent;
-    bool dirty;
-
-    void Update();
-    void Do();
-
-    friend class Application;
+    // Slot of the transform in TransformStorage, also the entity
+    // the components are registered under
+    uint32_t transform;
 };
 
 #endif // GAMEOBJECT_H
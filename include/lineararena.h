@@ -0,0 +1,108 @@
+#ifndef LINEARARENA_H
+#define LINEARARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct LinearArenaStats
+{
+    uintmax_t allocations;  // Requests served
+    uintmax_t blocks;       // Requests that went to the heap
+    uintmax_t bytes;
+};
+
+// Bump allocator for temporaries sharing one lifetime. Memory comes from
+// large blocks and is only given back all at once by Reset or Release,
+// individual deallocations are no-ops.
+class LinearArena
+{
+public:
+    static constexpr size_t DefaultBlockSize = 1 << 20;
+
+    explicit LinearArena(size_t = DefaultBlockSize);
+    ~LinearArena();
+
+    void *Allocate(size_t, size_t);
+    // Rewinds to the start, keeping the memory. When the last cycle needed
+    // several blocks they are merged into one that holds all of it, so that
+    // a cycle no larger than the previous ones never reaches the heap.
+    void Reset();
+    // Frees every block, pointers handed out so far become invalid
+    void Release();
+
+    // Bytes taken since the last Reset or Release, alignment padding and
+    // the unused ends of full blocks included
+    size_t GetUsed() const;
+    // Totals since construction, Reset and Release do not clear them
+    LinearArenaStats GetStats() const;
+
+private:
+    // At the start of each block
+    struct Header
+    {
+        uint8_t *previous;
+        size_t size;
+    };
+    uint8_t *block;
+    uint8_t *cursor, *end;
+    size_t blockSize;
+    size_t used;
+    LinearArenaStats stats;
+
+    void AllocateBlock(size_t);
+
+    LinearArena(const LinearArena &) = delete;
+    LinearArena &operator=(const LinearArena &) = delete;
+};
+
+// Adapter for standard containers, the arena has to outlive them
+template<typename T>
+class LinearAllocator
+{
+public:
+    using value_type = T;
+
+    LinearAllocator(LinearArena &arena)
+        : arena(&arena)
+    {
+    }
+
+    template<typename U>
+    LinearAllocator(const LinearAllocator<U> &other)
+        : arena(other.arena)
+    {
+    }
+
+    T *allocate(size_t count)
+    {
+        return static_cast<T *>(arena->Allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t)
+    {
+    }
+
+    template<typename U>
+    bool operator==(const LinearAllocator<U> &other) const
+    {
+        return arena == other.arena;
+    }
+
+    template<typename U>
+    bool operator!=(const LinearAllocator<U> &other) const
+    {
+        return arena != other.arena;
+    }
+
+private:
+    LinearArena *arena;
+
+    template<typename>
+    friend class LinearAllocator;
+};
+
+template<typename T>
+using LinearVector = std::vector<T, LinearAllocator<T>>;
+
+#endif // LINEARARENA_H
@@ -2,27 +2,77 @@
 #define MATERIAL_H
 
 #include "abstract/component.h"
+#include "abstract/pooled.h"
+
+#include <glm/glm.hpp>
 
 #include <string>
 #include <unordered_map>
 
+// Each combination of features is compiled into its own shader program
+enum class ShaderFeature : uint32_t
+{
+    None = 0,
+    Lightmap = 1 << 0,
+    BaseTexture = 1 << 1,
+    HDRDecode = 1 << 2,
+    AlphaTest = 1 << 3
+};
+
+inline ShaderFeature operator|(ShaderFeature a, ShaderFeature b)
+{
+    return static_cast<ShaderFeature>(static_cast<uint32_t>(a) | static_cast<uint32_t>(b));
+}
+
+inline ShaderFeature operator&(ShaderFeature a, ShaderFeature b)
+{
+    return static_cast<ShaderFeature>(static_cast<uint32_t>(a) & static_cast<uint32_t>(b));
+}
+
+inline ShaderFeature operator~(ShaderFeature a)
+{
+    return static_cast<ShaderFeature>(~static_cast<uint32_t>(a));
+}
+
+class DrawList;
 class Texture;
-class Material : public Component
+class Material : public Component, public Pooled<Material>
 {
-    static uint32_t shaderProgram;
-    static int32_t mvpLocation[];
+    struct Program
+    {
+        uint32_t name;
+        int32_t mvpLocation[3];
+    };
+    static std::unordered_map<uint32_t, Program> programs;
+    static uint32_t count;
 
 public:
-    explicit Material();
+    explicit Material(ShaderFeature = ShaderFeature::None);
 
+    uint32_t GetSortKey() const;
     Texture *GetTexture(std::string);
     void SetTexture(std::string, Texture *);
 
+    ShaderFeature GetFeatures() const;
+    void SetFeature(ShaderFeature, bool);
+
+    // Builds the program for these features now instead of on first use
+    static void Precompile(ShaderFeature);
+
 private:
-    std::unordered_map<int32_t, Texture *> textures;
+    uint32_t id;
+    ShaderFeature features;
+    Texture *textures[2];
+    mutable const Program *program;
+
+    void Bind() const;
+    void SetModelMatrix(const glm::mat4 &) const;
+    void Attach(uint32_t);
+    void Detach(uint32_t);
+
+    static const Program &GetProgram(ShaderFeature);
 
-    void Initialize();
-    void Do(GameObject *);
+    friend class DrawList;
 };
 
 #endif // MATERIAL_H
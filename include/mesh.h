@@ -2,11 +2,14 @@
 #define MESH_H
 
 #include "abstract/component.h"
+#include "abstract/pooled.h"
 
 #include <glm/glm.hpp>
 
 #include <vector>
 
+class DrawList;
+class MeshArena;
 struct Vertex
 {
     glm::vec3 position;
@@ -14,18 +17,50 @@ struct Vertex
     glm::vec2 uv2;
 };
 
-class Mesh : public Component
+// 16 bytes instead of 28, decoded by the attribute formats and
+// GetDecodeMatrix
+struct PackedVertex
+{
+    uint16_t position[4];  // unorm, within the mesh bounds
+    uint32_t uv1;  // half2
+    uint32_t uv2;  // unorm2x16
+};
+
+enum class VertexFormat
+{
+    Float,
+    Packed
+};
+
+class Mesh : public Component, public Pooled<Mesh>
 {
 public:
     explicit Mesh(const std::vector<uint32_t> &,
-                  const std::vector<Vertex> &);
+                  const std::vector<Vertex> &,
+                  VertexFormat = VertexFormat::Float);
+    explicit Mesh(const uint32_t *, size_t,
+                  const Vertex *, size_t,
+                  VertexFormat = VertexFormat::Float);
     ~Mesh();
 
+    void GetBounds(glm::vec3 &, glm::vec3 &) const;
+    // Bounds of the mesh transformed by the matrix
+    void GetBounds(const glm::mat4 &, glm::vec3 &, glm::vec3 &) const;
+    // Maps stored positions back to object space
+    glm::mat4 GetDecodeMatrix() const;
+
 private:
-    size_t indicesCount;
-    uint32_t vao, vbo, ebo;
+    MeshArena *arena;
+    size_t baseVertex, vertexCount;
+    size_t firstIndex, indicesCount;
+    VertexFormat format;
+    glm::vec3 mins, maxs;
+
+    void Draw() const;
+    void Attach(uint32_t);
+    void Detach(uint32_t);
 
-    void Do(GameObject *);
+    friend class DrawList;
 };
 
 #endif // MESH_H
@@ -0,0 +1,75 @@
+#ifndef MESHARENA_H
+#define MESHARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+// First-fit allocator over a range of elements, coalescing on free
+class FreeList
+{
+public:
+    explicit FreeList(size_t);
+
+    bool Allocate(size_t, size_t &);
+    void Free(size_t, size_t);
+    void Grow(size_t);
+
+    size_t GetCapacity() const;
+    size_t GetUsed() const;
+    size_t GetFreeBlocks() const;
+    size_t GetLargestFreeBlock() const;
+
+private:
+    std::map<size_t, size_t> blocks;
+    size_t capacity;
+    size_t used;
+};
+
+struct ArenaStats
+{
+    size_t capacity;
+    size_t used;
+    size_t freeBlocks;
+    // 0 when all free space is contiguous, close to 1 when it is scattered
+    float fragmentation;
+};
+
+enum class VertexFormat;
+
+// Shared vertex and index buffers for every mesh of one vertex format,
+// drawn with a single vertex array object
+class MeshArena
+{
+public:
+    static MeshArena *Get(VertexFormat);
+    static void Release();
+
+    void Allocate(const void *, size_t, const uint32_t *, size_t, size_t &, size_t &);
+    void Free(size_t, size_t, size_t, size_t);
+    void Bind() const;
+
+    ArenaStats GetVertexStats() const;
+    ArenaStats GetIndexStats() const;
+
+private:
+    static MeshArena *arenas[2];
+
+    VertexFormat format;
+    size_t stride;
+    uint32_t vao, vbo, ebo;
+    FreeList vertexes;
+    FreeList indices;
+
+    explicit MeshArena(VertexFormat);
+    ~MeshArena();
+
+    void SetupAttributes();
+
+    // Replaces the buffer with a new one of the given size, holding a copy
+    // of the old contents
+    static void Resize(uint32_t &, size_t, size_t);
+    static ArenaStats GetStats(const FreeList &);
+};
+
+#endif // MESHARENA_H
@@ -0,0 +1,27 @@
+#ifndef OCCLUDER_H
+#define OCCLUDER_H
+
+#include "abstract/component.h"
+#include "abstract/pooled.h"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Triangle list, in object space, rendered into the occlusion buffer
+class Occluder : public Component, public Pooled<Occluder>
+{
+public:
+    explicit Occluder(const std::vector<glm::vec3> &);
+    explicit Occluder(const glm::vec3 *, size_t);
+
+    const std::vector<glm::vec3> &GetVertexes() const;
+
+private:
+    std::vector<glm::vec3> vertexes;
+
+    void Attach(uint32_t);
+    void Detach(uint32_t);
+};
+
+#endif // OCCLUDER_H
@@ -0,0 +1,49 @@
+#ifndef OCCLUSIONBUFFER_H
+#define OCCLUSIONBUFFER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+// Low resolution software depth buffer filled from large occluders every
+// frame, with a max-depth pyramid for conservative bounding box tests
+class OcclusionBuffer
+{
+public:
+    explicit OcclusionBuffer(uint32_t = 256, uint32_t = 128);
+
+    void AddOccluder(const glm::mat4 &, const std::vector<glm::vec3> &);
+    void Rasterize(const glm::mat4 &);
+
+    bool IsVisible(const glm::vec3 &, const glm::vec3 &) const;
+
+private:
+    struct Occluder
+    {
+        glm::mat4 model;
+        const std::vector<glm::vec3> *vertexes;
+    };
+    struct Triangle
+    {
+        // Edge functions, already shrunk by half a pixel so that only
+        // fully covered pixels pass
+        float a[3], b[3], c[3];
+        int32_t minX, minY, maxX, maxY;
+        float depth;
+    };
+    struct Level
+    {
+        uint32_t width, height;
+        std::vector<float> depth;
+    };
+    glm::mat4 viewProjection;
+    std::vector<Occluder> occluders;
+    std::vector<Triangle> triangles;
+    std::vector<Level> levels;
+
+    void SetupTriangle(const glm::mat4 &, const glm::vec3 *, Triangle &) const;
+    void RasterizeBand(uint32_t, uint32_t);
+    void BuildPyramid();
+};
+
+#endif // OCCLUSIONBUFFER_H
@@ -0,0 +1,42 @@
+#ifndef PIXELBUFFERPOOL_H
+#define PIXELBUFFERPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct __GLsync;
+
+// Pixel unpack buffers for staging texture uploads. A buffer goes back into
+// rotation once the fence placed after the uploads reading from it has
+// passed, so filling one never waits on the GPU unless all of them are busy.
+class PixelBufferPool
+{
+public:
+    // Binds a buffer of at least the given size to GL_PIXEL_UNPACK_BUFFER
+    // and maps it for writing
+    static uint8_t *Acquire(size_t);
+    // Unmaps the buffer, leaving it bound for the uploads reading from it
+    static void Unmap();
+    // Fences the uploads issued since Unmap and unbinds the buffer
+    static void Release();
+
+    static void Clear();
+
+private:
+    struct Buffer
+    {
+        uint32_t name;
+        size_t capacity;
+        __GLsync *fence;
+        // Order in which the fence was placed
+        uint64_t issue;
+    };
+    static std::vector<Buffer> buffers;
+    static size_t current;
+    static uint64_t issued;
+
+    static bool IsIdle(Buffer &);
+};
+
+#endif // PIXELBUFFERPOOL_H
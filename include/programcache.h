@@ -0,0 +1,28 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <string>
+#include <unordered_map>
+
+// Linked shader programs, kept in memory and as driver binaries on disk.
+// Binaries are keyed by the sources and the driver that produced them and
+// are rebuilt from source whenever the driver rejects them.
+class ProgramCache
+{
+public:
+    static uint32_t GetProgram(const std::string &, const std::string &);
+    static void SetDirectory(const std::string &);
+    static void Clear();
+
+private:
+    static std::unordered_map<uint64_t, uint32_t> programs;
+    static std::string directory;
+
+    static uint64_t Hash(const std::string &, const std::string &);
+    static std::string GetPath(uint64_t);
+    static uint32_t Load(uint64_t);
+    static void Store(uint64_t, uint32_t);
+    static uint32_t Compile(const std::string &, const std::string &);
+};
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,170 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+class ComponentPoolBase
+{
+public:
+    virtual ~ComponentPoolBase()
+    {
+    }
+
+    virtual bool Contains(uint32_t) const = 0;
+    virtual void Remove(uint32_t) = 0;
+};
+
+// Components of one type in a sparse set. The dense arrays are packed and
+// walked by systems, the sparse one finds the entry of an entity.
+template<typename T>
+class ComponentPool : public ComponentPoolBase
+{
+public:
+    static constexpr uint32_t None = 0xFFFFFFFF;
+
+    explicit ComponentPool();
+
+    bool Contains(uint32_t entity) const
+    {
+        return entity < sparse.size() && sparse[entity] != None;
+    }
+
+    T &Get(uint32_t entity)
+    {
+        return components[sparse[entity]];
+    }
+
+    void Insert(uint32_t entity, const T &component)
+    {
+        if (Contains(entity))
+        {
+            throw std::logic_error("Component of this type is already attached to the object");
+        }
+
+        if (sparse.size() <= entity)
+        {
+            sparse.resize(entity + 1, None);
+        }
+
+        sparse[entity] = entities.size();
+        entities.push_back(entity);
+        components.push_back(component);
+    }
+
+    void Remove(uint32_t entity)
+    {
+        if (!Contains(entity))
+        {
+            throw std::logic_error("This component is not attached to this object");
+        }
+
+        // The last entry fills the hole
+        auto index = sparse[entity];
+
+        sparse[entities.back()] = index;
+        entities[index] = entities.back();
+        components[index] = components.back();
+
+        sparse[entity] = None;
+        entities.pop_back();
+        components.pop_back();
+    }
+
+    size_t GetSize() const
+    {
+        return entities.size();
+    }
+
+    uint32_t GetEntity(size_t index) const
+    {
+        return entities[index];
+    }
+
+    T &GetComponent(size_t index)
+    {
+        return components[index];
+    }
+
+private:
+    std::vector<uint32_t> sparse;
+    std::vector<uint32_t> entities;
+    std::vector<T> components;
+};
+
+// Entities are the transform slots of the game objects, components are
+// stored by type in their own pool and gathered by queries
+class Registry
+{
+public:
+    template<typename T>
+    static ComponentPool<T> &GetPool()
+    {
+        static ComponentPool<T> pool;
+        return pool;
+    }
+
+    template<typename... Types>
+    static bool Has(uint32_t entity)
+    {
+        return HasAll(entity, static_cast<Types *>(nullptr)...);
+    }
+
+    // Calls function(entity, T &, Others &...) for the entities having all
+    // of these components, walking entries [begin, end) of the pool of T
+    template<typename T, typename... Others, typename Function>
+    static void Each(size_t begin, size_t end, Function function)
+    {
+        auto &pool = GetPool<T>();
+
+        for (auto i = begin; i < end; i++)
+        {
+            auto entity = pool.GetEntity(i);
+
+            if (Has<Others...>(entity))
+            {
+                function(entity, pool.GetComponent(i), GetPool<Others>().Get(entity)...);
+            }
+        }
+    }
+
+    template<typename T, typename... Others, typename Function>
+    static void Each(Function function)
+    {
+        Each<T, Others...>(0, GetPool<T>().GetSize(), function);
+    }
+
+    // Drops every component of the entity
+    static void Remove(uint32_t);
+
+private:
+    static std::vector<ComponentPoolBase *> pools;
+
+    // Any entity has every component of an empty list
+    static bool HasAll(uint32_t)
+    {
+        return true;
+    }
+
+    template<typename T, typename... Others>
+    static bool HasAll(uint32_t entity, T *, Others *...)
+    {
+        return GetPool<T>().Contains(entity) && HasAll(entity, static_cast<Others *>(nullptr)...);
+    }
+
+    template<typename T>
+    friend class ComponentPool;
+};
+
+template<typename T>
+constexpr uint32_t ComponentPool<T>::None;
+
+template<typename T>
+ComponentPool<T>::ComponentPool()
+{
+    Registry::pools.push_back(this);
+}
+
+#endif // REGISTRY_H
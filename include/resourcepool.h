@@ -0,0 +1,169 @@
+#ifndef RESOURCEPOOL_H
+#define RESOURCEPOOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+// Refers to an object of a pool. The generation of the slot changes when
+// the object is destroyed, so stale handles resolve to nullptr instead of
+// another object reusing the slot.
+template<typename T>
+struct Handle
+{
+    static constexpr uint32_t None = 0xFFFFFFFF;
+
+    uint32_t index;
+    uint32_t generation;
+
+    Handle()
+        : index(None)
+        , generation(0)
+    {
+    }
+
+    Handle(uint32_t index, uint32_t generation)
+        : index(index)
+        , generation(generation)
+    {
+    }
+
+    bool operator==(const Handle &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const Handle &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+template<typename T>
+constexpr uint32_t Handle<T>::None;
+
+// Slot map of every live object of one type. Objects join the pool on
+// construction and leave it on destruction in constant time, whether they
+// are deleted directly, through a handle or all at once by Clear.
+template<typename T>
+class ResourcePool
+{
+public:
+    template<typename... Args>
+    static Handle<T> Create(Args &&... args)
+    {
+        return (new T(std::forward<Args>(args)...))->GetHandle();
+    }
+
+    static void Destroy(Handle<T> handle)
+    {
+        delete Get(handle);
+    }
+
+    static T *Get(Handle<T> handle)
+    {
+        if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation)
+        {
+            return nullptr;
+        }
+
+        return objects[slots[handle.index].dense];
+    }
+
+    // Deletes every object of the pool
+    static void Clear()
+    {
+        // Each destructor pops its object, objects created meanwhile
+        // are deleted as well
+        while (!objects.empty())
+        {
+            delete objects.back();
+        }
+    }
+
+    static size_t GetCount()
+    {
+        return objects.size();
+    }
+
+    // Live objects are packed, in no particular order
+    static T *GetObject(size_t index)
+    {
+        return objects[index];
+    }
+
+    static void ReportLeaks(const char *name)
+    {
+        if (!objects.empty())
+        {
+            std::cerr << objects.size() << " " << name << " objects were not released" << std::endl;
+        }
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t generation;
+        uint32_t dense;
+    };
+    // Slots stay where handles point, objects are kept packed with the
+    // slot of each one alongside
+    static std::vector<Slot> slots;
+    static std::vector<uint32_t> freeSlots;
+    static std::vector<T *> objects;
+    static std::vector<uint32_t> owners;
+
+    static Handle<T> Insert(T *object)
+    {
+        uint32_t index;
+
+        if (freeSlots.empty())
+        {
+            index = slots.size();
+            slots.push_back({0, 0});
+        }
+        else
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+
+        slots[index].dense = objects.size();
+        objects.push_back(object);
+        owners.push_back(index);
+
+        return Handle<T>(index, slots[index].generation);
+    }
+
+    static void Erase(Handle<T> handle)
+    {
+        // The last object fills the hole
+        auto dense = slots[handle.index].dense;
+
+        objects[dense] = objects.back();
+        owners[dense] = owners.back();
+        slots[owners[dense]].dense = dense;
+
+        objects.pop_back();
+        owners.pop_back();
+
+        slots[handle.index].generation++;
+        freeSlots.push_back(handle.index);
+    }
+
+    template<typename>
+    friend class Pooled;
+};
+
+template<typename T>
+std::vector<typename ResourcePool<T>::Slot> ResourcePool<T>::slots;
+template<typename T>
+std::vector<uint32_t> ResourcePool<T>::freeSlots;
+template<typename T>
+std::vector<T *> ResourcePool<T>::objects;
+template<typename T>
+std::vector<uint32_t> ResourcePool<T>::owners;
+
+#endif // RESOURCEPOOL_H
@@ -0,0 +1,201 @@
+#ifndef TEXELVIEW_H
+#define TEXELVIEW_H
+
+#include "texture.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+// Layout of one texel, known at compile time. Only defined for the
+// uncompressed formats, block compressed ones have no texel addressing.
+template<TextureFormat>
+struct TexelFormat;
+
+template<>
+struct TexelFormat<TextureFormat::RGB24>
+{
+    static constexpr uint32_t Stride = 3;
+
+    static Color Decode(const uint8_t *texel)
+    {
+        return Color(texel[0], texel[1], texel[2], 255);
+    }
+
+    static void Encode(uint8_t *texel, const Color &color)
+    {
+        texel[0] = color.r;
+        texel[1] = color.g;
+        texel[2] = color.b;
+    }
+};
+
+template<>
+struct TexelFormat<TextureFormat::RGBA32>
+{
+    static constexpr uint32_t Stride = 4;
+
+    static Color Decode(const uint8_t *texel)
+    {
+        return Color(texel[0], texel[1], texel[2], texel[3]);
+    }
+
+    static void Encode(uint8_t *texel, const Color &color)
+    {
+        texel[0] = color.r;
+        texel[1] = color.g;
+        texel[2] = color.b;
+        texel[3] = color.a;
+    }
+};
+
+// Level 0 of a texture seen as texels of one format, read only when Byte
+// is const
+template<TextureFormat Format, typename Byte = uint8_t>
+class TexelView
+{
+public:
+    using Texel = TexelFormat<Format>;
+    static constexpr uint32_t Stride = Texel::Stride;
+
+    explicit TexelView(Texture &texture)
+        : TexelView(GetData(texture, std::is_const<Byte>()), texture.GetWidth(), texture.GetHeight())
+    {
+        Check(texture);
+    }
+
+    explicit TexelView(const Texture &texture)
+        : TexelView(texture.Row(0), texture.GetWidth(), texture.GetHeight())
+    {
+        Check(texture);
+    }
+
+    TexelView(Byte *data, uint32_t width, uint32_t height)
+        : data(data)
+        , width(width)
+        , height(height)
+    {
+    }
+
+    uint32_t GetWidth() const
+    {
+        return width;
+    }
+
+    uint32_t GetHeight() const
+    {
+        return height;
+    }
+
+    Byte *Row(uint32_t y) const
+    {
+        return data + static_cast<size_t>(y) * width * Stride;
+    }
+
+    Color Load(uint32_t x, uint32_t y) const
+    {
+        return Texel::Decode(Row(y) + x * Stride);
+    }
+
+    void Store(uint32_t x, uint32_t y, const Color &color) const
+    {
+        Texel::Encode(Row(y) + x * Stride, color);
+    }
+
+private:
+    Byte *data;
+    uint32_t width, height;
+
+    // Read only views leave the mip chain of the texture alone
+    static Byte *GetData(Texture &texture, std::false_type)
+    {
+        return texture.Row(0);
+    }
+
+    static Byte *GetData(const Texture &texture, std::true_type)
+    {
+        return texture.Row(0);
+    }
+
+    static void Check(const Texture &texture)
+    {
+        if (texture.GetFormat() != Format)
+        {
+            throw std::logic_error("Texture format does not match the view");
+        }
+    }
+};
+
+template<TextureFormat Source, TextureFormat Dest>
+void ConvertTexels(const uint8_t *source, uint8_t *dest, size_t count)
+{
+    if (Source == Dest)
+    {
+        // Blits within one texture may overlap inside a row, BlitKernel
+        // orders the rows themselves
+        std::memmove(dest, source, count * TexelFormat<Dest>::Stride);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        TexelFormat<Dest>::Encode(dest + i * TexelFormat<Dest>::Stride,
+                                  TexelFormat<Source>::Decode(source + i * TexelFormat<Source>::Stride));
+    }
+}
+
+// Calls kernel.Run<Format>() for a format only known at run time, once per
+// operation, so that the texel loops inside are compiled for that format
+template<typename Kernel>
+void DispatchTexelFormat(TextureFormat format, Kernel &kernel)
+{
+    switch (format)
+    {
+    case TextureFormat::RGB24:
+        kernel.template Run<TextureFormat::RGB24>();
+        break;
+
+    case TextureFormat::RGBA32:
+        kernel.template Run<TextureFormat::RGBA32>();
+        break;
+
+    default:
+        throw std::logic_error("Not supported for compressed textures");
+    }
+}
+
+template<typename Kernel, TextureFormat Source>
+struct DestFormatDispatch
+{
+    Kernel &kernel;
+
+    template<TextureFormat Dest>
+    void Run()
+    {
+        kernel.template Run<Source, Dest>();
+    }
+};
+
+template<typename Kernel>
+struct SourceFormatDispatch
+{
+    Kernel &kernel;
+    TextureFormat dest;
+
+    template<TextureFormat Source>
+    void Run()
+    {
+        DestFormatDispatch<Kernel, Source> dispatch{kernel};
+        DispatchTexelFormat(dest, dispatch);
+    }
+};
+
+// Same for kernels over two formats, calls kernel.Run<Source, Dest>()
+template<typename Kernel>
+void DispatchTexelFormats(TextureFormat source, TextureFormat dest, Kernel &kernel)
+{
+    SourceFormatDispatch<Kernel> dispatch{kernel, dest};
+    DispatchTexelFormat(source, dispatch);
+}
+
+#endif // TEXELVIEW_H
@@ -1,7 +1,8 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
-#include "abstract/disposable.h"
+#include "abstract/pooled.h"
+#include "blockencoder.h"
 
 #include <glm/glm.hpp>
 using uvec2 = glm::tvec2<uint32_t>;
@@ -15,6 +16,12 @@ struct Rect
     uvec2 size;
 };
 
+struct AtlasRect
+{
+    uint32_t page;
+    Rect rect;
+};
+
 enum class TextureFormat
 {
     DXT1,
@@ -25,20 +32,35 @@ enum class TextureFormat
     RGBA32
 };
 
+enum class MipFilter
+{
+    Box,   // 2x2 average
+    Kaiser // Separable 6 tap windowed sinc, sharper on minification
+};
+
+class LinearArena;
 class Material;
-class Texture : Disposable
+class Texture : public Pooled<Texture>
 {
 public:
     explicit Texture(uint32_t, uint32_t, TextureFormat = TextureFormat::RGBA32);
     ~Texture();
 
+    // Uploads level 0, and the mip chain as well when asked to. A missing
+    // chain is generated for uncompressed textures, compressed ones only
+    // upload the levels loaded or compressed along with them.
     void Apply(bool);
-    void LoadRawTextureData(const uintptr_t *);
-    std::vector<Rect> PackTextures(const std::vector<Texture *> &);
+    void Compress(TextureFormat, CompressionQuality = CompressionQuality::Normal);
+    void Convert(TextureFormat);
+    void GenerateMipmaps(MipFilter = MipFilter::Box);
+    // Takes the given number of levels, level 0 first, one after the other
+    void LoadRawTextureData(const uintptr_t *, uint32_t = 1);
 
     uintmax_t GetArea() const;
     uint32_t GetWidth() const;
     uint32_t GetHeight() const;
+    uint32_t GetMipmapCount() const;
+    TextureFormat GetFormat() const;
 
     Color GetPixel(uint32_t) const;
     Color GetPixel(uint32_t, uint32_t) const;
@@ -46,6 +68,27 @@ public:
     void SetPixel(uint32_t, const Color &);
     void SetPixel(uint32_t, uint32_t, const Color &);
 
+    // Bulk access for uncompressed textures, a row at a time
+    uint8_t *Row(uint32_t);
+    const uint8_t *Row(uint32_t) const;
+
+    void Blit(const Texture &, const Rect &, const uvec2 &);
+    void Fill(const Color &);
+    void Fill(const Rect &, const Color &);
+
+    // Packs textures into as few square pages as needed, none larger than
+    // the given size or the largest size the driver supports
+    static std::vector<Texture *> PackTextures(const std::vector<Texture *> &, std::vector<AtlasRect> &,
+                                               uint32_t = 0, TextureFormat = TextureFormat::RGBA32);
+    // Places rects of the given sizes the same way without any textures,
+    // returns the size of each page
+    static std::vector<uint32_t> PackRects(const std::vector<uvec2> &, std::vector<AtlasRect> &, uint32_t = 0);
+    static uint32_t GetMaxSize();
+
+    // Halves an image of 8 bit channels with a 2x2 box filter, for levels
+    // built away from any texture
+    static void DownsampleBox(const uint8_t *, uint32_t, uint32_t, uint32_t, uint8_t *);
+
 private:
     struct Node
     {
@@ -57,19 +100,29 @@ private:
         Rect rc;
         bool used = false;
 
-        ~Node();
-        Node *Insert(const Texture *);
+        Node *Insert(const uvec2 &, LinearArena &);
     };
     uint32_t name;
     int32_t internalformat;
     int32_t format;
+    TextureFormat textureFormat;
     uint32_t width, height;
     uint32_t bitsPerPixel;
     bool compressed;
     std::vector<uint8_t> buffer;
+    // Levels from 1 down to 1x1, dropped whenever level 0 changes
+    std::vector<std::vector<uint8_t>> mipmaps;
+    // Shape of the GPU storage, reallocated when Apply needs another one
+    uint32_t storageLevels;
+    uint32_t storageWidth, storageHeight;
+    int32_t storageFormat;
 
     void Allocate(uint32_t, uint32_t);
-    std::vector<Rect> PackTextures(const std::vector<Texture *> &, uint32_t, uint32_t);
+    void AllocateStorage(uint32_t);
+    void SetFormat(TextureFormat);
+    size_t GetLevelSize(uint32_t, uint32_t) const;
+
+    static void DownsampleKaiser(const uint8_t *, uint32_t, uint32_t, uint32_t, uint8_t *);
 
     friend class Material;
 };
@@ -0,0 +1,97 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool;
+
+// Number of unfinished jobs, for waiting on them and for jobs that depend
+// on them. Has to outlive the jobs that count on it or wait for it.
+class JobCounter
+{
+public:
+    explicit JobCounter();
+
+    bool IsDone() const;
+
+private:
+    struct Job
+    {
+        std::function<void()> function;
+        JobCounter *counter;
+    };
+    std::atomic<uint32_t> count;
+    mutable std::mutex mutex;
+    // Jobs held back until the count drops to zero
+    std::vector<Job> waiting;
+
+    JobCounter(const JobCounter &) = delete;
+    JobCounter &operator=(const JobCounter &) = delete;
+
+    friend class ThreadPool;
+};
+
+// Shared workers, one per core with the main thread as the first. Every
+// thread keeps its own queue, running its newest job first and taking the
+// oldest ones of the others when it runs out.
+class ThreadPool
+{
+public:
+    static size_t GetThreadCount();
+    static bool IsMainThread();
+
+    // Queues a job that counts on the first counter, if any, and starts
+    // once the second one is done. Jobs must not throw.
+    static void Run(const std::function<void()> &, JobCounter * = nullptr, JobCounter * = nullptr);
+    // Runs other jobs until the counter is done. Jobs queued for the main
+    // thread are run as well when called from it.
+    static void Wait(const JobCounter &);
+
+    // Splits [0, count) into contiguous ranges and runs them on the pool,
+    // the calling thread included. Returns once every range is done.
+    static void ParallelFor(size_t, const std::function<void(size_t, size_t)> &);
+
+    // Queues a job for the main thread, which owns the GL context
+    static void RunOnMainThread(const std::function<void()> &, JobCounter * = nullptr);
+    // Runs the jobs queued for the main thread, from the main thread
+    static void RunMainThreadJobs();
+
+private:
+    using Job = JobCounter::Job;
+    struct Queue
+    {
+        std::deque<Job> jobs;
+        std::mutex mutex;
+    };
+    std::vector<std::thread> threads;
+    // Index 0 belongs to the main thread
+    std::vector<Queue> queues;
+    Queue mainThreadJobs;
+    std::thread::id mainThread;
+    // Queued jobs, as a hint for sleeping threads
+    std::atomic<size_t> pending;
+    std::atomic<size_t> mainThreadPending;
+    std::mutex sleepMutex;
+    std::condition_variable condition;
+    bool stopping;
+
+    explicit ThreadPool();
+    ~ThreadPool();
+
+    static ThreadPool &Instance();
+
+    void Schedule(Job &&);
+    void Finish(JobCounter *);
+    bool RunPending();
+    bool RunMainThreadJob();
+    void Wake();
+    void Work(size_t);
+};
+
+#endif // THREADPOOL_H
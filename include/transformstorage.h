@@ -0,0 +1,58 @@
+#ifndef TRANSFORMSTORAGE_H
+#define TRANSFORMSTORAGE_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <vector>
+
+// Transforms of every game object, kept in parallel arrays indexed by slot
+// so that world matrices are refreshed in passes over contiguous memory.
+// Local transforms are owned by the slot, world matrices are derived from
+// the parent's and only recomputed below the slots that changed.
+class TransformStorage
+{
+public:
+    static constexpr uint32_t None = 0xFFFFFFFF;
+
+    static uint32_t Allocate();
+    static void Free(uint32_t);
+
+    static void SetParent(uint32_t, uint32_t);
+    static void MarkDirty(uint32_t);
+
+    // Recomputes the world matrices of every dirty subtree, one depth
+    // level at a time, so that parents are always done before children
+    static void Update();
+
+    static size_t GetCount();
+    static const glm::mat4 &GetWorldMatrix(uint32_t);
+    // Slots whose world matrix was recomputed by the last Update
+    static const std::vector<uint32_t> &GetUpdated();
+
+private:
+    static std::vector<glm::vec3> positions;
+    static std::vector<glm::quat> rotations;
+    static std::vector<glm::vec3> scales;
+    static std::vector<glm::mat4> worlds;
+    static std::vector<uint32_t> parents;
+    static std::vector<uint32_t> firstChildren;
+    static std::vector<uint32_t> nextSiblings;
+    static std::vector<uint32_t> previousSiblings;
+    static std::vector<uint32_t> depths;
+    static std::vector<uint8_t> dirty;
+    static std::vector<uint32_t> freeSlots;
+    static std::vector<uint32_t> dirtySlots;
+    static std::vector<std::vector<uint32_t>> levels;
+    static std::vector<uint32_t> updated;
+    // Traversal scratch, kept so that walking subtrees does not allocate
+    static std::vector<uint32_t> stack;
+
+    static void Detach(uint32_t);
+    static void SetDepth(uint32_t, uint32_t);
+    static glm::mat4 GetLocalMatrix(uint32_t);
+
+    friend class GameObject;
+};
+
+#endif // TRANSFORMSTORAGE_H
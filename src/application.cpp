@@ -1,13 +1,30 @@
 #include "application.h"
-#include "abstract/disposable.h"
+#include "assetmanager.h"
+#include "bvh.h"
 #include "camera.h"
+#include "drawlist.h"
+#include "dynamicresolution.h"
+#include "frameallocator.h"
 #include "gameobject.h"
+#include "material.h"
+#include "mesh.h"
+#include "mesharena.h"
+#include "occluder.h"
+#include "occlusionbuffer.h"
+#include "pixelbufferpool.h"
+#include "programcache.h"
+#include "registry.h"
+#include "resourcepool.h"
+#include "texture.h"
+#include "threadpool.h"
+#include "transformstorage.h"
 
 #include <glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp>
 using glm::mat4;
 using glm::perspective;
+using glm::vec3;
 
 #include <stdexcept>
 #include <unordered_map>
@@ -24,6 +41,37 @@ static unordered_map<int, bool> buttons;
 static unordered_map<int, bool> keys;
 static mat4 projection;
 
+static BVH *bvh;
+static DrawList *drawList;
+static DynamicResolution *dynamicResolution;
+static OcclusionBuffer *occlusionBuffer;
+
+// Moves the meshes whose transforms changed in the scene tree, rebuilding
+// it when most of it changed at once, as after loading a map
+static void UpdateBounds()
+{
+    auto &meshes = Registry::GetPool<const Mesh *>();
+    size_t moved = 0;
+
+    for (auto entity : TransformStorage::GetUpdated())
+    {
+        if (!meshes.Contains(entity))
+        {
+            continue;
+        }
+
+        vec3 mins, maxs;
+        meshes.Get(entity)->GetBounds(TransformStorage::GetWorldMatrix(entity), mins, maxs);
+        bvh->Update(entity, mins, maxs);
+        moved++;
+    }
+
+    if (moved * 2 > bvh->GetSize())
+    {
+        bvh->Rebuild();
+    }
+}
+
 void cursor_position_callback(GLFWwindow *, double xpos, double ypos)
 {
     auto xoffset = xpos - lastX;
@@ -43,7 +91,7 @@ void cursor_position_callback(GLFWwindow *, double xpos, double ypos)
 void framebuffer_size_callback(GLFWwindow *, int width, int height)
 {
     projection = perspective(45.f, (GLfloat)width / (GLfloat)height, .1f, 1000.f);
-    glViewport(0, 0, width, height);
+    dynamicResolution->Resize(width, height);
 }
 
 void key_callback(GLFWwindow *, int key, int, int action, int)
@@ -103,7 +151,11 @@ Application::Application(const char *name, int width, int height, float rotateSp
         throw runtime_error("Failed to initialize GLAD");
     }
 
+    bvh = new BVH;
     camera = new Camera(rotateSpeed, moveSpeed);
+    drawList = new DrawList;
+    dynamicResolution = new DynamicResolution;
+    occlusionBuffer = new OcclusionBuffer;
 
     glfwGetCursorPos(window, &lastX, &lastY);
 
@@ -120,12 +172,34 @@ Application::~Application()
 {
     instance = nullptr;
 
-    for (size_t i = 0; i < Disposable::allocated.size(); i++)
-    {
-        delete Disposable::allocated[i];
-    }
+    // Callbacks of pending assets may still refer to the objects
+    AssetManager::Clear();
+
+    // Objects before their components, components before their textures
+    ResourcePool<GameObject>::Clear();
+    ResourcePool<Occluder>::Clear();
+    ResourcePool<Mesh>::Clear();
+    ResourcePool<Material>::Clear();
+    ResourcePool<Texture>::Clear();
+
+    ResourcePool<GameObject>::ReportLeaks("GameObject");
+    ResourcePool<Occluder>::ReportLeaks("Occluder");
+    ResourcePool<Mesh>::ReportLeaks("Mesh");
+    ResourcePool<Material>::ReportLeaks("Material");
+    ResourcePool<Texture>::ReportLeaks("Texture");
+
+    FrameAllocator::Clear();
+    MeshArena::Release();
+    PixelBufferPool::Clear();
+    ProgramCache::Clear();
+
+    delete bvh;
+    bvh = nullptr;
 
     delete camera;
+    delete drawList;
+    delete dynamicResolution;
+    delete occlusionBuffer;
 
     buttons.clear();
     keys.clear();
@@ -134,6 +208,11 @@ Application::~Application()
     glfwTerminate();
 }
 
+BVH *Application::GetBVH()
+{
+    return bvh;
+}
+
 const Camera *Application::GetCamera()
 {
     return camera;
@@ -144,6 +223,16 @@ double Application::GetDeltaTime()
     return instance->deltaTime;
 }
 
+DynamicResolution *Application::GetDynamicResolution()
+{
+    return dynamicResolution;
+}
+
+OcclusionBuffer *Application::GetOcclusionBuffer()
+{
+    return occlusionBuffer;
+}
+
 mat4 Application::GetProjectionMatrix()
 {
     return projection;
@@ -164,7 +253,11 @@ int Application::exec()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        FrameAllocator::BeginFrame();
+
         glfwPollEvents();
+        ThreadPool::RunMainThreadJobs();
+        AssetManager::Update();
 
         if (keys[GLFW_KEY_W])
         {
@@ -186,13 +279,26 @@ int Application::exec()
             camera->ProcessKeyboard(Direction::Right);
         }
 
+        dynamicResolution->Begin();
+
         glClearColor(1.f, 1.f, 1.f, 1.f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        for (auto object : GameObject::instances)
+        TransformStorage::Update();
+        UpdateBounds();
+
+        Registry::Each<const Occluder *>([](uint32_t entity, const Occluder *occluder)
         {
-            object->Do();
-        }
+            occlusionBuffer->AddOccluder(TransformStorage::GetWorldMatrix(entity), occluder->GetVertexes());
+        });
+
+        auto view = camera->GetViewMatrix();
+        occlusionBuffer->Rasterize(projection * view);
+
+        drawList->Build(view);
+        drawList->Submit();
+
+        dynamicResolution->End();
 
         glfwSwapInterval(0);
         glfwSwapBuffers(window);
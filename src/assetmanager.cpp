@@ -0,0 +1,192 @@
+#include "assetmanager.h"
+
+#include <algorithm>
+#include <chrono>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::remove;
+using std::shared_ptr;
+using std::stable_sort;
+using std::vector;
+
+constexpr double AssetManager::UploadBudget;
+
+mutex AssetManager::requestsMutex;
+vector<shared_ptr<AssetBase>> AssetManager::queued;
+vector<shared_ptr<AssetBase>> AssetManager::loaded;
+size_t AssetManager::loading;
+JobCounter AssetManager::loads;
+
+static bool ComparePriorities(const shared_ptr<AssetBase> &a, const shared_ptr<AssetBase> &b)
+{
+    return a->GetPriority() > b->GetPriority();
+}
+
+AssetBase::AssetBase(const vector<shared_ptr<AssetBase>> &dependencies, int priority)
+    : state(AssetState::Pending)
+    , priority(priority)
+    , cancelled(false)
+    , dependencies(dependencies)
+{
+}
+
+AssetBase::~AssetBase()
+{
+}
+
+AssetState AssetBase::GetState() const
+{
+    return state;
+}
+
+bool AssetBase::IsDone() const
+{
+    auto current = GetState();
+
+    return current == AssetState::Resident ||
+           current == AssetState::Failed ||
+           current == AssetState::Cancelled;
+}
+
+int AssetBase::GetPriority() const
+{
+    return priority;
+}
+
+void AssetBase::SetPriority(int priority)
+{
+    this->priority = priority;
+}
+
+void AssetBase::Cancel()
+{
+    cancelled = true;
+}
+
+void AssetManager::Update()
+{
+    vector<shared_ptr<AssetBase>> starting, uploading, dropped;
+
+    {
+        lock_guard<mutex> lock(requestsMutex);
+
+        for (auto &asset : queued)
+        {
+            if (asset->cancelled)
+            {
+                dropped.push_back(asset);
+                asset = nullptr;
+            }
+        }
+
+        queued.erase(remove(queued.begin(), queued.end(), nullptr), queued.end());
+        stable_sort(queued.begin(), queued.end(), ComparePriorities);
+
+        // One load per thread, so that new requests of higher priority
+        // do not queue up behind everything requested before
+        auto count = min(queued.size(), ThreadPool::GetThreadCount() - min(loading, ThreadPool::GetThreadCount()));
+        starting.assign(queued.begin(), queued.begin() + count);
+        queued.erase(queued.begin(), queued.begin() + count);
+        loading += count;
+
+        uploading.swap(loaded);
+    }
+
+    for (const auto &asset : starting)
+    {
+        Start(asset);
+    }
+
+    // Callbacks may request more assets, so they run without the lock
+    for (const auto &asset : dropped)
+    {
+        asset->Complete(AssetState::Cancelled);
+    }
+
+    stable_sort(uploading.begin(), uploading.end(), ComparePriorities);
+
+    auto start = steady_clock::now();
+    size_t uploads = 0;
+    vector<shared_ptr<AssetBase>> deferred;
+
+    for (const auto &asset : uploading)
+    {
+        if (asset->cancelled)
+        {
+            asset->Complete(AssetState::Cancelled);
+            continue;
+        }
+
+        auto failed = asset->GetState() == AssetState::Failed;
+        auto blocked = false;
+
+        for (const auto &dependency : asset->dependencies)
+        {
+            auto state = dependency->GetState();
+
+            failed = failed || state == AssetState::Failed || state == AssetState::Cancelled;
+            blocked = blocked || state != AssetState::Resident;
+        }
+
+        if (failed)
+        {
+            asset->Complete(AssetState::Failed);
+            continue;
+        }
+
+        if (blocked || (uploads && duration<double>(steady_clock::now() - start).count() > UploadBudget))
+        {
+            deferred.push_back(asset);
+            continue;
+        }
+
+        asset->Upload();
+        asset->Complete(asset->GetState());
+        uploads++;
+    }
+
+    lock_guard<mutex> lock(requestsMutex);
+    loaded.insert(loaded.end(), deferred.begin(), deferred.end());
+}
+
+void AssetManager::Clear()
+{
+    ThreadPool::Wait(loads);
+
+    vector<shared_ptr<AssetBase>> dropped;
+
+    {
+        lock_guard<mutex> lock(requestsMutex);
+
+        dropped.insert(dropped.end(), queued.begin(), queued.end());
+        dropped.insert(dropped.end(), loaded.begin(), loaded.end());
+        queued.clear();
+        loaded.clear();
+    }
+
+    for (const auto &asset : dropped)
+    {
+        asset->Complete(AssetState::Cancelled);
+    }
+}
+
+size_t AssetManager::GetPendingCount()
+{
+    lock_guard<mutex> lock(requestsMutex);
+    return queued.size() + loading + loaded.size();
+}
+
+void AssetManager::Start(const shared_ptr<AssetBase> &asset)
+{
+    ThreadPool::Run([asset]
+    {
+        asset->Load();
+
+        lock_guard<mutex> lock(requestsMutex);
+        loaded.push_back(asset);
+        loading--;
+    }, &loads);
+}
@@ -0,0 +1,478 @@
+#include "blockencoder.h"
+#include "texture.h"
+#include "threadpool.h"
+
+using glm::clamp;
+using glm::dot;
+using glm::normalize;
+using glm::vec3;
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::logic_error;
+using std::max;
+using std::min;
+using std::mutex;
+using std::numeric_limits;
+using std::swap;
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Position along the endpoint line to the index stored in the block
+constexpr uint8_t ColorIndices[4] = { 0, 2, 3, 1 };
+
+EncoderStats BlockEncoder::stats;
+
+// Images may be encoded from several jobs at once
+static mutex statsMutex;
+
+static void GetRange(const float *values, float &low, float &high)
+{
+#ifdef __SSE2__
+    auto lowest = _mm_load_ps(values);
+    auto highest = lowest;
+
+    for (int i = 4; i < 16; i += 4)
+    {
+        auto value = _mm_load_ps(values + i);
+        lowest = _mm_min_ps(lowest, value);
+        highest = _mm_max_ps(highest, value);
+    }
+
+    lowest = _mm_min_ps(lowest, _mm_shuffle_ps(lowest, lowest, _MM_SHUFFLE(1, 0, 3, 2)));
+    lowest = _mm_min_ps(lowest, _mm_shuffle_ps(lowest, lowest, _MM_SHUFFLE(2, 3, 0, 1)));
+    highest = _mm_max_ps(highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(1, 0, 3, 2)));
+    highest = _mm_max_ps(highest, _mm_shuffle_ps(highest, highest, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    low = _mm_cvtss_f32(lowest);
+    high = _mm_cvtss_f32(highest);
+#else
+    low = values[0];
+    high = values[0];
+
+    for (int i = 1; i < 16; i++)
+    {
+        low = min(low, values[i]);
+        high = max(high, values[i]);
+    }
+#endif
+}
+
+void BlockEncoder::Encode(const uint8_t *rgba, uint32_t width, uint32_t height,
+                          TextureFormat format, CompressionQuality quality, uint8_t *blocks)
+{
+    auto blockSize = GetBlockSize(format);
+    auto blocksX = (width + 3) / 4;
+    auto blocksY = (height + 3) / 4;
+    auto start = steady_clock::now();
+
+    ThreadPool::ParallelFor(blocksY, [&](size_t begin, size_t end)
+    {
+        Block block;
+
+        for (auto y = begin; y < end; y++)
+        {
+            for (uint32_t x = 0; x < blocksX; x++)
+            {
+                auto dest = blocks + (y * blocksX + x) * blockSize;
+
+                Fetch(rgba, width, height, x, y, block);
+
+                switch (format)
+                {
+                case TextureFormat::DXT1:
+                    EncodeColor(block, quality, dest);
+                    break;
+
+                case TextureFormat::DXT3:
+                    EncodeExplicitAlpha(block, dest);
+                    EncodeColor(block, quality, dest + 8);
+                    break;
+
+                case TextureFormat::DXT5:
+                    EncodeInterpolatedAlpha(block, dest);
+                    EncodeColor(block, quality, dest + 8);
+                    break;
+
+                default:
+                    break;
+                }
+            }
+        }
+    });
+
+    lock_guard<mutex> lock(statsMutex);
+    stats.blocks += blocksX * blocksY;
+    stats.seconds += duration<double>(steady_clock::now() - start).count();
+}
+
+size_t BlockEncoder::GetBlockSize(TextureFormat format)
+{
+    switch (format)
+    {
+    case TextureFormat::DXT1:
+        return 8;
+
+    case TextureFormat::DXT3:
+    case TextureFormat::DXT5:
+        return 16;
+
+    default:
+        throw logic_error("Not supported by the block encoder");
+    }
+}
+
+EncoderStats BlockEncoder::GetStats()
+{
+    lock_guard<mutex> lock(statsMutex);
+    return stats;
+}
+
+void BlockEncoder::Fetch(const uint8_t *rgba, uint32_t width, uint32_t height, uint32_t blockX, uint32_t blockY, Block &block)
+{
+    // Blocks hanging over the edge repeat the last row and column
+    for (uint32_t y = 0; y < 4; y++)
+    {
+        auto row = rgba + min(blockY * 4 + y, height - 1) * width * 4;
+
+        for (uint32_t x = 0; x < 4; x++)
+        {
+            auto pixel = row + min(blockX * 4 + x, width - 1) * 4;
+
+            for (int c = 0; c < 4; c++)
+            {
+                block.channel[c][y * 4 + x] = pixel[c];
+            }
+        }
+    }
+}
+
+void BlockEncoder::EncodeColor(const Block &block, CompressionQuality quality, uint8_t *dest)
+{
+    vec3 start, end;
+
+    if (quality == CompressionQuality::Fast)
+    {
+        GetBoundingBox(block, end, start);
+
+        // Pulling the endpoints in a little lowers the average error,
+        // the extremes are rarely hit exactly anyway
+        auto inset = (start - end) / 16.f;
+        start -= inset;
+        end += inset;
+    }
+    else
+    {
+        GetPrincipalAxis(block, start, end);
+    }
+
+    uint8_t positions[16];
+    auto color0 = To565(start);
+    auto color1 = To565(end);
+    auto error = SelectIndices(block, From565(color0), From565(color1), positions);
+
+    if (quality == CompressionQuality::High)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            uint8_t refinedPositions[16];
+
+            if (!Refine(block, positions, start, end))
+            {
+                break;
+            }
+
+            auto refined0 = To565(start);
+            auto refined1 = To565(end);
+            auto refinedError = SelectIndices(block, From565(refined0), From565(refined1), refinedPositions);
+
+            if (refinedError >= error)
+            {
+                break;
+            }
+
+            error = refinedError;
+            color0 = refined0;
+            color1 = refined1;
+            memcpy(positions, refinedPositions, sizeof(positions));
+        }
+    }
+
+    // Four color mode needs the first endpoint to be the larger one
+    if (color0 < color1)
+    {
+        swap(color0, color1);
+
+        for (auto &position : positions)
+        {
+            position = 3 - position;
+        }
+    }
+
+    uint32_t indices = 0;
+
+    if (color0 != color1)
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            indices |= ColorIndices[positions[i]] << (i * 2);
+        }
+    }
+
+    dest[0] = color0 & 0xFF;
+    dest[1] = color0 >> 8;
+    dest[2] = color1 & 0xFF;
+    dest[3] = color1 >> 8;
+
+    for (int i = 0; i < 4; i++)
+    {
+        dest[4 + i] = indices >> (i * 8);
+    }
+}
+
+void BlockEncoder::EncodeExplicitAlpha(const Block &block, uint8_t *dest)
+{
+    for (int i = 0; i < 16; i += 2)
+    {
+        auto low = static_cast<uint8_t>(block.channel[3][i] * 15.f / 255.f + .5f);
+        auto high = static_cast<uint8_t>(block.channel[3][i + 1] * 15.f / 255.f + .5f);
+
+        dest[i / 2] = low | high << 4;
+    }
+}
+
+void BlockEncoder::EncodeInterpolatedAlpha(const Block &block, uint8_t *dest)
+{
+    float low, high;
+    GetRange(block.channel[3], low, high);
+
+    // The larger endpoint first selects the eight value mode
+    auto alpha0 = static_cast<uint8_t>(high);
+    auto alpha1 = static_cast<uint8_t>(low);
+    uint64_t indices = 0;
+
+    if (alpha0 != alpha1)
+    {
+        auto scale = 7.f / (alpha0 - alpha1);
+
+        for (int i = 0; i < 16; i++)
+        {
+            auto position = static_cast<int>((alpha0 - block.channel[3][i]) * scale + .5f);
+            uint64_t index = position == 0 ? 0 : position == 7 ? 1 : position + 1;
+
+            indices |= index << (i * 3);
+        }
+    }
+
+    dest[0] = alpha0;
+    dest[1] = alpha1;
+
+    for (int i = 0; i < 6; i++)
+    {
+        dest[2 + i] = indices >> (i * 8);
+    }
+}
+
+void BlockEncoder::GetBoundingBox(const Block &block, vec3 &mins, vec3 &maxs)
+{
+    for (int c = 0; c < 3; c++)
+    {
+        GetRange(block.channel[c], mins[c], maxs[c]);
+    }
+}
+
+void BlockEncoder::GetPrincipalAxis(const Block &block, vec3 &start, vec3 &end)
+{
+    vec3 mean(0.f);
+
+    for (int i = 0; i < 16; i++)
+    {
+        mean += vec3(block.channel[0][i], block.channel[1][i], block.channel[2][i]);
+    }
+
+    mean /= 16.f;
+
+    // Upper half of the covariance matrix
+    float covariance[6] = {};
+
+    for (int i = 0; i < 16; i++)
+    {
+        auto d = vec3(block.channel[0][i], block.channel[1][i], block.channel[2][i]) - mean;
+
+        covariance[0] += d.x * d.x;
+        covariance[1] += d.x * d.y;
+        covariance[2] += d.x * d.z;
+        covariance[3] += d.y * d.y;
+        covariance[4] += d.y * d.z;
+        covariance[5] += d.z * d.z;
+    }
+
+    // Power iteration, starting from the bounding box diagonal
+    vec3 mins, maxs;
+    GetBoundingBox(block, mins, maxs);
+
+    auto axis = maxs - mins;
+
+    for (int i = 0; i < 4; i++)
+    {
+        axis = vec3(covariance[0] * axis.x + covariance[1] * axis.y + covariance[2] * axis.z,
+                    covariance[1] * axis.x + covariance[3] * axis.y + covariance[4] * axis.z,
+                    covariance[2] * axis.x + covariance[4] * axis.y + covariance[5] * axis.z);
+
+        auto largest = max(max(std::fabs(axis.x), std::fabs(axis.y)), std::fabs(axis.z));
+
+        // A single color
+        if (largest < 1e-6f)
+        {
+            start = mean;
+            end = mean;
+            return;
+        }
+
+        axis /= largest;
+    }
+
+    axis = normalize(axis);
+
+    auto low = numeric_limits<float>::max();
+    auto high = -numeric_limits<float>::max();
+
+    for (int i = 0; i < 16; i++)
+    {
+        auto t = dot(vec3(block.channel[0][i], block.channel[1][i], block.channel[2][i]) - mean, axis);
+
+        low = min(low, t);
+        high = max(high, t);
+    }
+
+    start = mean + axis * high;
+    end = mean + axis * low;
+}
+
+bool BlockEncoder::Refine(const Block &block, const uint8_t *positions, vec3 &start, vec3 &end)
+{
+    // Least squares endpoints for the current index assignment
+    float aa = 0.f, ab = 0.f, bb = 0.f;
+    vec3 ap(0.f), bp(0.f);
+
+    for (int i = 0; i < 16; i++)
+    {
+        auto beta = positions[i] / 3.f;
+        auto alpha = 1.f - beta;
+        auto pixel = vec3(block.channel[0][i], block.channel[1][i], block.channel[2][i]);
+
+        aa += alpha * alpha;
+        ab += alpha * beta;
+        bb += beta * beta;
+        ap += pixel * alpha;
+        bp += pixel * beta;
+    }
+
+    auto determinant = aa * bb - ab * ab;
+
+    if (std::fabs(determinant) < 1e-6f)
+    {
+        return false;
+    }
+
+    start = clamp((ap * bb - bp * ab) / determinant, 0.f, 255.f);
+    end = clamp((bp * aa - ap * ab) / determinant, 0.f, 255.f);
+    return true;
+}
+
+float BlockEncoder::SelectIndices(const Block &block, const vec3 &start, const vec3 &end, uint8_t *positions)
+{
+    auto axis = end - start;
+    auto length = dot(axis, axis);
+    auto scale = length > 0.f ? 3.f / length : 0.f;
+
+#ifdef __SSE2__
+    auto originR = _mm_set1_ps(start.x);
+    auto originG = _mm_set1_ps(start.y);
+    auto originB = _mm_set1_ps(start.z);
+    auto axisR = _mm_set1_ps(axis.x);
+    auto axisG = _mm_set1_ps(axis.y);
+    auto axisB = _mm_set1_ps(axis.z);
+    auto scaledR = _mm_set1_ps(axis.x * scale);
+    auto scaledG = _mm_set1_ps(axis.y * scale);
+    auto scaledB = _mm_set1_ps(axis.z * scale);
+    auto zero = _mm_setzero_ps();
+    auto three = _mm_set1_ps(3.f);
+    auto third = _mm_set1_ps(1.f / 3.f);
+    auto error = _mm_setzero_ps();
+
+    for (int i = 0; i < 16; i += 4)
+    {
+        auto r = _mm_sub_ps(_mm_load_ps(block.channel[0] + i), originR);
+        auto g = _mm_sub_ps(_mm_load_ps(block.channel[1] + i), originG);
+        auto b = _mm_sub_ps(_mm_load_ps(block.channel[2] + i), originB);
+
+        auto t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, scaledR), _mm_mul_ps(g, scaledG)), _mm_mul_ps(b, scaledB));
+        auto position = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(t, zero), three));
+        auto step = _mm_mul_ps(_mm_cvtepi32_ps(position), third);
+
+        r = _mm_sub_ps(r, _mm_mul_ps(step, axisR));
+        g = _mm_sub_ps(g, _mm_mul_ps(step, axisG));
+        b = _mm_sub_ps(b, _mm_mul_ps(step, axisB));
+        error = _mm_add_ps(error, _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(g, g)), _mm_mul_ps(b, b)));
+
+        alignas(16) int32_t values[4];
+        _mm_store_si128(reinterpret_cast<__m128i *>(values), position);
+
+        for (int j = 0; j < 4; j++)
+        {
+            positions[i + j] = values[j];
+        }
+    }
+
+    alignas(16) float sums[4];
+    _mm_store_ps(sums, error);
+
+    return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+    auto error = 0.f;
+
+    for (int i = 0; i < 16; i++)
+    {
+        auto d = vec3(block.channel[0][i], block.channel[1][i], block.channel[2][i]) - start;
+        auto position = static_cast<int>(clamp(dot(d, axis) * scale, 0.f, 3.f) + .5f);
+
+        d -= axis * (position / 3.f);
+        error += dot(d, d);
+        positions[i] = position;
+    }
+
+    return error;
+#endif
+}
+
+uint16_t BlockEncoder::To565(const vec3 &color)
+{
+    auto r = static_cast<uint16_t>(clamp(color.x, 0.f, 255.f) * 31.f / 255.f + .5f);
+    auto g = static_cast<uint16_t>(clamp(color.y, 0.f, 255.f) * 63.f / 255.f + .5f);
+    auto b = static_cast<uint16_t>(clamp(color.z, 0.f, 255.f) * 31.f / 255.f + .5f);
+
+    return r << 11 | g << 5 | b;
+}
+
+vec3 BlockEncoder::From565(uint16_t color)
+{
+    // Expanded the way the hardware does, by replicating the high bits
+    auto r = color >> 11 & 31;
+    auto g = color >> 5 & 63;
+    auto b = color & 31;
+
+    return vec3(static_cast<float>(r << 3 | r >> 2),
+                static_cast<float>(g << 2 | g >> 4),
+                static_cast<float>(b << 3 | b >> 2));
+}
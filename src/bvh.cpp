@@ -0,0 +1,603 @@
+#include "bvh.h"
+#include "frameallocator.h"
+#include "frustum.h"
+
+using glm::dot;
+using glm::max;
+using glm::min;
+using glm::vec3;
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+using std::logic_error;
+using std::numeric_limits;
+using std::partition;
+using std::vector;
+
+// Leaves are enlarged by this fraction of their size on every side
+constexpr float Margin = .1f;
+constexpr float MinimumMargin = .01f;
+// Leaves whose enlarged box became this much larger than needed are
+// reinserted even if the item still fits
+constexpr float MaximumSlack = 4.f;
+
+constexpr uint32_t Bins = 16;
+
+constexpr uint32_t BVH::None;
+
+static float GetArea(const vec3 &mins, const vec3 &maxs)
+{
+    auto size = maxs - mins;
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static bool IntersectRay(const vec3 &mins, const vec3 &maxs,
+                         const vec3 &origin, const vec3 &inverse, float maxDistance, float &distance)
+{
+    auto t1 = (mins - origin) * inverse;
+    auto t2 = (maxs - origin) * inverse;
+    auto lower = min(t1, t2);
+    auto upper = max(t1, t2);
+
+    auto enter = std::max(std::max(lower.x, lower.y), std::max(lower.z, 0.f));
+    auto exit = std::min(std::min(upper.x, upper.y), std::min(upper.z, maxDistance));
+
+    distance = enter;
+    return enter <= exit;
+}
+
+BVH::BVH()
+    : root(None)
+    , size(0)
+{
+}
+
+bool BVH::Contains(uint32_t id) const
+{
+    return id < leaves.size() && leaves[id] != None;
+}
+
+size_t BVH::GetSize() const
+{
+    return size;
+}
+
+void BVH::Update(uint32_t id, const vec3 &mins, const vec3 &maxs)
+{
+    auto margin = (maxs - mins) * Margin + vec3(MinimumMargin);
+    auto fatMins = mins - margin;
+    auto fatMaxs = maxs + margin;
+
+    uint32_t leaf;
+
+    if (Contains(id))
+    {
+        leaf = leaves[id];
+
+        const auto &node = nodes[leaf];
+
+        if (node.mins.x <= mins.x && node.mins.y <= mins.y && node.mins.z <= mins.z &&
+                node.maxs.x >= maxs.x && node.maxs.y >= maxs.y && node.maxs.z >= maxs.z &&
+                GetArea(node.mins, node.maxs) <= GetArea(fatMins, fatMaxs) * MaximumSlack)
+        {
+            return;
+        }
+
+        RemoveLeaf(leaf);
+    }
+    else
+    {
+        if (leaves.size() <= id)
+        {
+            leaves.resize(id + 1, None);
+        }
+
+        leaf = AllocateNode();
+        leaves[id] = leaf;
+        nodes[leaf].id = id;
+        size++;
+    }
+
+    nodes[leaf].mins = fatMins;
+    nodes[leaf].maxs = fatMaxs;
+    InsertLeaf(leaf);
+}
+
+void BVH::Remove(uint32_t id)
+{
+    if (!Contains(id))
+    {
+        throw logic_error("This item is not in the tree");
+    }
+
+    RemoveLeaf(leaves[id]);
+    FreeNode(leaves[id]);
+    leaves[id] = None;
+    size--;
+}
+
+void BVH::Rebuild()
+{
+    vector<uint32_t> items;
+
+    for (auto leaf : leaves)
+    {
+        if (leaf != None)
+        {
+            items.push_back(leaf);
+        }
+    }
+
+    // Inner nodes are all rebuilt, so every one of them is free
+    freeNodes.clear();
+
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        if (nodes[i].id == None)
+        {
+            freeNodes.push_back(i);
+        }
+    }
+
+    root = items.empty() ? None : Build(items.data(), items.size());
+
+    if (root != None)
+    {
+        nodes[root].parent = None;
+    }
+}
+
+void BVH::Clear()
+{
+    nodes.clear();
+    freeNodes.clear();
+    leaves.clear();
+    root = None;
+    size = 0;
+}
+
+void BVH::QueryFrustum(const Frustum &frustum, vector<uint32_t> &ids) const
+{
+    if (root == None)
+    {
+        return;
+    }
+
+    LinearVector<uint32_t> stack(1, root, FrameAllocator::GetAllocator<uint32_t>());
+
+    while (!stack.empty())
+    {
+        const auto &node = nodes[stack.back()];
+        auto index = stack.back();
+        stack.pop_back();
+
+        auto containment = frustum.Classify(node.mins, node.maxs);
+
+        if (containment == Containment::Outside)
+        {
+            continue;
+        }
+
+        if (node.id != None)
+        {
+            ids.push_back(node.id);
+        }
+        else if (containment == Containment::Inside)
+        {
+            // Everything below is visible, no more plane tests needed
+            vector<uint32_t> subtree(1, index);
+
+            while (!subtree.empty())
+            {
+                const auto &child = nodes[subtree.back()];
+                subtree.pop_back();
+
+                if (child.id != None)
+                {
+                    ids.push_back(child.id);
+                }
+                else
+                {
+                    subtree.push_back(child.children[0]);
+                    subtree.push_back(child.children[1]);
+                }
+            }
+        }
+        else
+        {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+void BVH::QueryRadius(const vec3 &center, float radius, vector<uint32_t> &ids) const
+{
+    if (root == None)
+    {
+        return;
+    }
+
+    LinearVector<uint32_t> stack(1, root, FrameAllocator::GetAllocator<uint32_t>());
+
+    while (!stack.empty())
+    {
+        const auto &node = nodes[stack.back()];
+        stack.pop_back();
+
+        auto offset = max(node.mins - center, vec3(0.f)) + max(center - node.maxs, vec3(0.f));
+
+        if (dot(offset, offset) > radius * radius)
+        {
+            continue;
+        }
+
+        if (node.id != None)
+        {
+            ids.push_back(node.id);
+        }
+        else
+        {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+void BVH::QueryRay(const vec3 &origin, const vec3 &direction, float maxDistance, vector<uint32_t> &ids) const
+{
+    if (root == None)
+    {
+        return;
+    }
+
+    auto inverse = vec3(1.f) / direction;
+    LinearVector<uint32_t> stack(1, root, FrameAllocator::GetAllocator<uint32_t>());
+
+    while (!stack.empty())
+    {
+        const auto &node = nodes[stack.back()];
+        stack.pop_back();
+
+        float distance;
+
+        if (!IntersectRay(node.mins, node.maxs, origin, inverse, maxDistance, distance))
+        {
+            continue;
+        }
+
+        if (node.id != None)
+        {
+            ids.push_back(node.id);
+        }
+        else
+        {
+            stack.push_back(node.children[0]);
+            stack.push_back(node.children[1]);
+        }
+    }
+}
+
+uint32_t BVH::Raycast(const vec3 &origin, const vec3 &direction, float maxDistance, float &distance) const
+{
+    auto nearest = None;
+    distance = maxDistance;
+
+    if (root == None)
+    {
+        return nearest;
+    }
+
+    auto inverse = vec3(1.f) / direction;
+    LinearVector<uint32_t> stack(1, root, FrameAllocator::GetAllocator<uint32_t>());
+
+    while (!stack.empty())
+    {
+        const auto &node = nodes[stack.back()];
+        stack.pop_back();
+
+        float enter;
+
+        if (!IntersectRay(node.mins, node.maxs, origin, inverse, distance, enter))
+        {
+            continue;
+        }
+
+        if (node.id != None)
+        {
+            nearest = node.id;
+            distance = enter;
+            continue;
+        }
+
+        // Nearer child last, so that it is visited first and shortens
+        // the ray for the other one
+        float enters[2];
+        auto hits0 = IntersectRay(nodes[node.children[0]].mins, nodes[node.children[0]].maxs, origin, inverse, distance, enters[0]);
+        auto hits1 = IntersectRay(nodes[node.children[1]].mins, nodes[node.children[1]].maxs, origin, inverse, distance, enters[1]);
+        auto first = enters[0] <= enters[1] ? 0 : 1;
+
+        if (hits0 && hits1)
+        {
+            stack.push_back(node.children[1 - first]);
+            stack.push_back(node.children[first]);
+        }
+        else if (hits0 || hits1)
+        {
+            stack.push_back(node.children[hits0 ? 0 : 1]);
+        }
+    }
+
+    return nearest;
+}
+
+uint32_t BVH::AllocateNode()
+{
+    uint32_t index;
+
+    if (freeNodes.empty())
+    {
+        index = nodes.size();
+        nodes.emplace_back();
+    }
+    else
+    {
+        index = freeNodes.back();
+        freeNodes.pop_back();
+    }
+
+    auto &node = nodes[index];
+    node.parent = None;
+    node.children[0] = None;
+    node.children[1] = None;
+    node.id = None;
+
+    return index;
+}
+
+void BVH::FreeNode(uint32_t index)
+{
+    nodes[index].id = None;
+    freeNodes.push_back(index);
+}
+
+void BVH::InsertLeaf(uint32_t leaf)
+{
+    if (root == None)
+    {
+        root = leaf;
+        nodes[leaf].parent = None;
+        return;
+    }
+
+    // Walks down to the sibling that adds the least surface area, stopping
+    // early when pairing with the current node is cheaper than any child
+    auto mins = nodes[leaf].mins;
+    auto maxs = nodes[leaf].maxs;
+    auto index = root;
+
+    while (nodes[index].id == None)
+    {
+        const auto &node = nodes[index];
+
+        auto area = GetArea(node.mins, node.maxs);
+        auto combined = GetArea(min(node.mins, mins), max(node.maxs, maxs));
+
+        // Pairing here, and the growth every node below would inherit
+        auto cost = 2.f * combined;
+        auto inheritance = 2.f * (combined - area);
+
+        float costs[2];
+
+        for (int i = 0; i < 2; i++)
+        {
+            const auto &child = nodes[node.children[i]];
+            auto enlarged = GetArea(min(child.mins, mins), max(child.maxs, maxs));
+
+            costs[i] = (child.id != None ? enlarged : enlarged - GetArea(child.mins, child.maxs)) + inheritance;
+        }
+
+        if (cost < costs[0] && cost < costs[1])
+        {
+            break;
+        }
+
+        index = node.children[costs[0] < costs[1] ? 0 : 1];
+    }
+
+    auto sibling = index;
+    auto grandparent = nodes[sibling].parent;
+    auto parent = AllocateNode();
+
+    nodes[parent].parent = grandparent;
+    nodes[parent].children[0] = sibling;
+    nodes[parent].children[1] = leaf;
+    nodes[sibling].parent = parent;
+    nodes[leaf].parent = parent;
+
+    if (grandparent == None)
+    {
+        root = parent;
+    }
+    else
+    {
+        auto &children = nodes[grandparent].children;
+        children[children[0] == sibling ? 0 : 1] = parent;
+    }
+
+    Refit(parent);
+}
+
+void BVH::RemoveLeaf(uint32_t leaf)
+{
+    if (leaf == root)
+    {
+        root = None;
+        return;
+    }
+
+    auto parent = nodes[leaf].parent;
+    auto grandparent = nodes[parent].parent;
+    auto sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+
+    // The sibling takes the place of the parent
+    nodes[sibling].parent = grandparent;
+    FreeNode(parent);
+
+    if (grandparent == None)
+    {
+        root = sibling;
+    }
+    else
+    {
+        auto &children = nodes[grandparent].children;
+        children[children[0] == parent ? 0 : 1] = sibling;
+        Refit(grandparent);
+    }
+}
+
+void BVH::Refit(uint32_t index)
+{
+    while (index != None)
+    {
+        auto &node = nodes[index];
+        const auto &a = nodes[node.children[0]];
+        const auto &b = nodes[node.children[1]];
+
+        node.mins = min(a.mins, b.mins);
+        node.maxs = max(a.maxs, b.maxs);
+
+        index = node.parent;
+    }
+}
+
+uint32_t BVH::Build(uint32_t *items, size_t count)
+{
+    if (count == 1)
+    {
+        return items[0];
+    }
+
+    auto centroidMins = vec3(numeric_limits<float>::max());
+    auto centroidMaxs = vec3(-numeric_limits<float>::max());
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto centroid = (nodes[items[i]].mins + nodes[items[i]].maxs) * .5f;
+        centroidMins = min(centroidMins, centroid);
+        centroidMaxs = max(centroidMaxs, centroid);
+    }
+
+    // Binned SAH: the split between bins with the least area weighted
+    // item count on both sides, over all three axes
+    struct Bin
+    {
+        vec3 mins, maxs;
+        size_t count;
+    };
+
+    auto bestCost = numeric_limits<float>::max();
+    int bestAxis = -1;
+    uint32_t bestSplit = 0;
+
+    for (int axis = 0; axis < 3; axis++)
+    {
+        auto extent = centroidMaxs[axis] - centroidMins[axis];
+
+        if (extent <= 0.f)
+        {
+            continue;
+        }
+
+        Bin bins[Bins];
+
+        for (auto &bin : bins)
+        {
+            bin.mins = vec3(numeric_limits<float>::max());
+            bin.maxs = vec3(-numeric_limits<float>::max());
+            bin.count = 0;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const auto &node = nodes[items[i]];
+            auto centroid = (node.mins[axis] + node.maxs[axis]) * .5f;
+            auto &bin = bins[std::min<uint32_t>((centroid - centroidMins[axis]) / extent * Bins, Bins - 1)];
+
+            bin.mins = min(bin.mins, node.mins);
+            bin.maxs = max(bin.maxs, node.maxs);
+            bin.count++;
+        }
+
+        // Area and count of everything right of each split
+        float rightCosts[Bins];
+        auto mins = vec3(numeric_limits<float>::max());
+        auto maxs = vec3(-numeric_limits<float>::max());
+        size_t right = 0;
+
+        for (auto i = Bins - 1; i > 0; i--)
+        {
+            mins = min(mins, bins[i].mins);
+            maxs = max(maxs, bins[i].maxs);
+            right += bins[i].count;
+            rightCosts[i] = right ? GetArea(mins, maxs) * right : 0.f;
+        }
+
+        mins = vec3(numeric_limits<float>::max());
+        maxs = vec3(-numeric_limits<float>::max());
+        size_t left = 0;
+
+        for (uint32_t i = 1; i < Bins; i++)
+        {
+            mins = min(mins, bins[i - 1].mins);
+            maxs = max(maxs, bins[i - 1].maxs);
+            left += bins[i - 1].count;
+
+            auto cost = (left ? GetArea(mins, maxs) * left : 0.f) + rightCosts[i];
+
+            if (left && left < count && cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    size_t middle;
+
+    if (bestAxis < 0)
+    {
+        // Every centroid is at the same place
+        middle = count / 2;
+    }
+    else
+    {
+        auto axis = bestAxis;
+        auto extent = centroidMaxs[axis] - centroidMins[axis];
+        auto offset = centroidMins[axis];
+        auto split = bestSplit;
+        const auto &nodes = this->nodes;
+
+        middle = partition(items, items + count, [&](uint32_t item)
+        {
+            auto centroid = (nodes[item].mins[axis] + nodes[item].maxs[axis]) * .5f;
+            return std::min<uint32_t>((centroid - offset) / extent * Bins, Bins - 1) < split;
+        }) - items;
+    }
+
+    auto left = Build(items, middle);
+    auto right = Build(items + middle, count - middle);
+    auto index = AllocateNode();
+
+    auto &node = nodes[index];
+    node.children[0] = left;
+    node.children[1] = right;
+    node.mins = min(nodes[left].mins, nodes[right].mins);
+    node.maxs = max(nodes[left].maxs, nodes[right].maxs);
+    nodes[left].parent = index;
+    nodes[right].parent = index;
+
+    return index;
+}
@@ -0,0 +1,163 @@
+#include "drawlist.h"
+#include "application.h"
+#include "bvh.h"
+#include "frustum.h"
+#include "material.h"
+#include "mesh.h"
+#include "mesharena.h"
+#include "occlusionbuffer.h"
+#include "registry.h"
+#include "threadpool.h"
+#include "transformstorage.h"
+
+#include <glad.h>
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+#include <algorithm>
+#include <cstring>
+using std::inplace_merge;
+using std::max;
+using std::remove_if;
+using std::sort;
+using std::vector;
+
+static bool CompareKeys(const DrawPacket &a, const DrawPacket &b)
+{
+    return a.key < b.key;
+}
+
+DrawList::DrawList()
+    : culled(0)
+{
+}
+
+void DrawList::Build(const mat4 &view)
+{
+    auto occlusionBuffer = Application::GetOcclusionBuffer();
+    auto &meshes = Registry::GetPool<const Mesh *>();
+    auto &materials = Registry::GetPool<const Material *>();
+
+    Frustum frustum(Application::GetProjectionMatrix() * view);
+
+    // The tree only knows the enlarged boxes, the exact ones are tested
+    // in one batch
+    candidates.clear();
+    Application::GetBVH()->QueryFrustum(frustum, candidates);
+
+    // Rejected by the tree, telling apart the ones without a material
+    // would mean walking every mesh
+    culled = meshes.GetSize() - candidates.size();
+
+    candidates.erase(remove_if(candidates.begin(), candidates.end(), [&](uint32_t entity)
+    {
+        return !materials.Contains(entity);
+    }), candidates.end());
+
+    bounds.Resize(candidates.size());
+
+    ThreadPool::ParallelFor(candidates.size(), [&](size_t begin, size_t end)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            vec3 mins, maxs;
+            meshes.Get(candidates[i])->GetBounds(TransformStorage::GetWorldMatrix(candidates[i]), mins, maxs);
+            bounds.Set(i, mins, maxs);
+        }
+    });
+
+    visible.resize(candidates.size());
+    visible.resize(frustum.Cull(bounds, visible.data()));
+    culled += candidates.size() - visible.size();
+
+    // A few slices per thread, so that uneven slices still balance out
+    slices.resize(ThreadPool::GetThreadCount() * 4);
+
+    auto count = slices.size();
+
+    ThreadPool::ParallelFor(count, [&](size_t begin, size_t end)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            auto &slice = slices[i];
+            slice.clear();
+
+            for (auto j = visible.size() * i / count; j < visible.size() * (i + 1) / count; j++)
+            {
+                auto entity = candidates[visible[j]];
+                auto mesh = meshes.Get(entity);
+                auto material = materials.Get(entity);
+                const auto &model = TransformStorage::GetWorldMatrix(entity);
+
+                vec3 mins, maxs;
+                bounds.Get(visible[j], mins, maxs);
+
+                if (!occlusionBuffer->IsVisible(mins, maxs))
+                {
+                    continue;
+                }
+
+                // Non-negative floats keep their order when compared as integers
+                auto depth = max(-(view * vec4((mins + maxs) * .5f, 1.f)).z, 0.f);
+                uint32_t depthBits;
+                memcpy(&depthBits, &depth, sizeof(depthBits));
+
+                slice.push_back(
+                {
+                    static_cast<uint64_t>(material->GetSortKey()) << 32 | depthBits,
+                    material,
+                    mesh,
+                    model * mesh->GetDecodeMatrix()
+                });
+            }
+
+            sort(slice.begin(), slice.end(), CompareKeys);
+        }
+    });
+
+    packets.clear();
+
+    for (const auto &slice : slices)
+    {
+        auto middle = packets.size();
+        packets.insert(packets.end(), slice.begin(), slice.end());
+        inplace_merge(packets.begin(), packets.begin() + middle, packets.end(), CompareKeys);
+    }
+}
+
+void DrawList::Submit() const
+{
+    const Material *material = nullptr;
+    const MeshArena *arena = nullptr;
+
+    for (const auto &packet : packets)
+    {
+        if (packet.material != material)
+        {
+            material = packet.material;
+            material->Bind();
+        }
+
+        if (packet.mesh->arena != arena)
+        {
+            arena = packet.mesh->arena;
+            arena->Bind();
+        }
+
+        material->SetModelMatrix(packet.model);
+        packet.mesh->Draw();
+    }
+
+    glBindVertexArray(0);
+}
+
+size_t DrawList::GetSize() const
+{
+    return packets.size();
+}
+
+size_t DrawList::GetCulledCount() const
+{
+    return culled;
+}
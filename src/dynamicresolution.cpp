@@ -0,0 +1,144 @@
+#include "dynamicresolution.h"
+#include "application.h"
+
+#include <glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+using std::max;
+using std::min;
+using std::runtime_error;
+
+DynamicResolution::DynamicResolution(double targetFrameTime, float minScale, float maxScale)
+    : frame(0)
+    , width(0)
+    , height(0)
+    , scaledWidth(0)
+    , scaledHeight(0)
+    , targetFrameTime(targetFrameTime)
+    , frameTime(targetFrameTime)
+    , minScale(minScale)
+    , maxScale(maxScale)
+    , scale(maxScale)
+{
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glGenQueries(Latency, queries);
+}
+
+DynamicResolution::~DynamicResolution()
+{
+    glDeleteQueries(Latency, queries);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteFramebuffers(1, &fbo);
+}
+
+void DynamicResolution::Resize(int newWidth, int newHeight)
+{
+    width = max(newWidth, 1);
+    height = max(newHeight, 1);
+
+    // Storage is sized for the largest scale, smaller scales only use
+    // part of it, so changing the scale never reallocates
+    auto storageWidth = max(static_cast<int>(width * maxScale), 1);
+    auto storageHeight = max(static_cast<int>(height * maxScale), 1);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, storageWidth, storageHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, storageWidth, storageHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        throw runtime_error("Failed to create offscreen framebuffer");
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void DynamicResolution::Begin()
+{
+    scaledWidth = max(static_cast<int>(width * scale), 1);
+    scaledHeight = max(static_cast<int>(height * scale), 1);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glViewport(0, 0, scaledWidth, scaledHeight);
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame % Latency]);
+}
+
+void DynamicResolution::End()
+{
+    glEndQuery(GL_TIME_ELAPSED);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, scaledWidth, scaledHeight,
+                      0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT,
+                      scaledWidth == width && scaledHeight == height ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+
+    frame++;
+
+    // The oldest query has had a couple of frames to finish, reading it
+    // does not stall the pipeline. Without a result yet, the whole frame
+    // time is used instead.
+    auto query = queries[frame % Latency];
+    int32_t available = 0;
+
+    if (frame >= Latency)
+    {
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    }
+
+    if (available)
+    {
+        uint64_t elapsed;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+        Update(elapsed * 1e-9);
+    }
+    else
+    {
+        Update(Application::GetDeltaTime());
+    }
+}
+
+float DynamicResolution::GetScale() const
+{
+    return scale;
+}
+
+void DynamicResolution::SetTargetFrameTime(double time)
+{
+    targetFrameTime = time;
+}
+
+void DynamicResolution::Update(double time)
+{
+    if (time <= 0.)
+    {
+        return;
+    }
+
+    frameTime += (time - frameTime) * .1;
+
+    // Cost grows with the pixel count, the square of the scale
+    auto desired = scale * static_cast<float>(std::sqrt(targetFrameTime / frameTime));
+
+    // Small deviations are left alone to avoid oscillating
+    if (std::fabs(desired - scale) < scale * .05f)
+    {
+        return;
+    }
+
+    scale = min(max(scale + (desired - scale) * .1f, minScale), maxScale);
+}
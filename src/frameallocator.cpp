@@ -0,0 +1,94 @@
+#include "frameallocator.h"
+
+#include <algorithm>
+#include <cassert>
+using std::find;
+using std::lock_guard;
+using std::max;
+using std::mutex;
+using std::vector;
+
+constexpr uint32_t FrameAllocator::FramesInFlight;
+
+vector<FrameAllocator::ThreadArenas *> FrameAllocator::threads;
+mutex FrameAllocator::threadsMutex;
+uint32_t FrameAllocator::frame;
+uintmax_t FrameAllocator::heapAllocations;
+
+FrameAllocator::ThreadArenas::ThreadArenas()
+    : peaks()
+    , blocks()
+{
+    lock_guard<mutex> lock(threadsMutex);
+    threads.push_back(this);
+}
+
+FrameAllocator::ThreadArenas::~ThreadArenas()
+{
+    lock_guard<mutex> lock(threadsMutex);
+    threads.erase(find(threads.begin(), threads.end(), this));
+}
+
+void FrameAllocator::BeginFrame()
+{
+    lock_guard<mutex> lock(threadsMutex);
+
+    auto last = frame % FramesInFlight;
+    heapAllocations = 0;
+
+    for (auto thread : threads)
+    {
+        const auto &arena = thread->arenas[last];
+        auto taken = arena.GetStats().blocks - thread->blocks[last];
+
+        // An arena holds as much as any earlier frame used, so the heap
+        // is only hit by a frame using more
+        assert(!taken || arena.GetUsed() > thread->peaks[last]);
+
+        heapAllocations += taken;
+        thread->peaks[last] = max(thread->peaks[last], arena.GetUsed());
+    }
+
+    frame++;
+
+    auto next = frame % FramesInFlight;
+
+    // Blocks merged on reset are not counted again, the frame that
+    // outgrew the arena already was
+    for (auto thread : threads)
+    {
+        thread->arenas[next].Reset();
+        thread->blocks[next] = thread->arenas[next].GetStats().blocks;
+    }
+}
+
+void *FrameAllocator::Allocate(size_t size, size_t alignment)
+{
+    return GetArena().Allocate(size, alignment);
+}
+
+uintmax_t FrameAllocator::GetHeapAllocations()
+{
+    return heapAllocations;
+}
+
+void FrameAllocator::Clear()
+{
+    lock_guard<mutex> lock(threadsMutex);
+
+    for (auto thread : threads)
+    {
+        for (uint32_t i = 0; i < FramesInFlight; i++)
+        {
+            thread->arenas[i].Release();
+            thread->peaks[i] = 0;
+            thread->blocks[i] = thread->arenas[i].GetStats().blocks;
+        }
+    }
+}
+
+LinearArena &FrameAllocator::GetArena()
+{
+    static thread_local ThreadArenas local;
+    return local.arenas[frame % FramesInFlight];
+}
@@ -0,0 +1,174 @@
+#include "frustum.h"
+
+using glm::dot;
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void BoxArrays::Resize(size_t size)
+{
+    minX.resize(size);
+    minY.resize(size);
+    minZ.resize(size);
+    maxX.resize(size);
+    maxY.resize(size);
+    maxZ.resize(size);
+}
+
+void BoxArrays::Set(size_t index, const vec3 &mins, const vec3 &maxs)
+{
+    minX[index] = mins.x;
+    minY[index] = mins.y;
+    minZ[index] = mins.z;
+    maxX[index] = maxs.x;
+    maxY[index] = maxs.y;
+    maxZ[index] = maxs.z;
+}
+
+void BoxArrays::Get(size_t index, vec3 &mins, vec3 &maxs) const
+{
+    mins = vec3(minX[index], minY[index], minZ[index]);
+    maxs = vec3(maxX[index], maxY[index], maxZ[index]);
+}
+
+size_t BoxArrays::GetSize() const
+{
+    return minX.size();
+}
+
+Frustum::Frustum(const mat4 &viewProjection)
+{
+    vec4 rows[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        rows[i] = vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+    }
+
+    // Left, right, bottom, top, near, far
+    for (int i = 0; i < 3; i++)
+    {
+        planes[i * 2] = rows[3] + rows[i];
+        planes[i * 2 + 1] = rows[3] - rows[i];
+    }
+}
+
+Containment Frustum::Classify(const vec3 &mins, const vec3 &maxs) const
+{
+    auto result = Containment::Inside;
+
+    for (const auto &plane : planes)
+    {
+        // Corners farthest along and against the plane normal
+        vec3 positive(plane.x >= 0.f ? maxs.x : mins.x,
+                      plane.y >= 0.f ? maxs.y : mins.y,
+                      plane.z >= 0.f ? maxs.z : mins.z);
+        vec3 negative(plane.x >= 0.f ? mins.x : maxs.x,
+                      plane.y >= 0.f ? mins.y : maxs.y,
+                      plane.z >= 0.f ? mins.z : maxs.z);
+
+        if (dot(vec3(plane), positive) + plane.w < 0.f)
+        {
+            return Containment::Outside;
+        }
+
+        if (dot(vec3(plane), negative) + plane.w < 0.f)
+        {
+            result = Containment::Intersecting;
+        }
+    }
+
+    return result;
+}
+
+size_t Frustum::Cull(const BoxArrays &boxes, uint32_t *visible) const
+{
+    // A box is outside when the corner farthest along the normal of any
+    // plane is behind it. Which arrays hold that corner only depends on
+    // the signs of the normal, so it is picked once per plane.
+    const float *corners[6][3];
+
+    for (int i = 0; i < 6; i++)
+    {
+        corners[i][0] = planes[i].x >= 0.f ? boxes.maxX.data() : boxes.minX.data();
+        corners[i][1] = planes[i].y >= 0.f ? boxes.maxY.data() : boxes.minY.data();
+        corners[i][2] = planes[i].z >= 0.f ? boxes.maxZ.data() : boxes.minZ.data();
+    }
+
+    auto size = boxes.GetSize();
+    size_t count = 0;
+    size_t i = 0;
+
+#if defined(__AVX__)
+    for (; i + 8 <= size; i += 8)
+    {
+        auto inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (int j = 0; j < 6; j++)
+        {
+            auto distance = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(planes[j].x), _mm256_loadu_ps(corners[j][0] + i)),
+                                          _mm256_mul_ps(_mm256_set1_ps(planes[j].y), _mm256_loadu_ps(corners[j][1] + i)));
+            distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_set1_ps(planes[j].z), _mm256_loadu_ps(corners[j][2] + i)));
+            distance = _mm256_add_ps(distance, _mm256_set1_ps(planes[j].w));
+
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_GE_OQ));
+        }
+
+        // Every index is written, only the visible ones advance the count
+        auto bits = _mm256_movemask_ps(inside);
+
+        for (int j = 0; j < 8; j++)
+        {
+            visible[count] = i + j;
+            count += (bits >> j) & 1;
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= size; i += 4)
+    {
+        auto inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (int j = 0; j < 6; j++)
+        {
+            auto distance = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[j].x), _mm_loadu_ps(corners[j][0] + i)),
+                                       _mm_mul_ps(_mm_set1_ps(planes[j].y), _mm_loadu_ps(corners[j][1] + i)));
+            distance = _mm_add_ps(distance, _mm_mul_ps(_mm_set1_ps(planes[j].z), _mm_loadu_ps(corners[j][2] + i)));
+            distance = _mm_add_ps(distance, _mm_set1_ps(planes[j].w));
+
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, _mm_setzero_ps()));
+        }
+
+        // Every index is written, only the visible ones advance the count
+        auto bits = _mm_movemask_ps(inside);
+
+        for (int j = 0; j < 4; j++)
+        {
+            visible[count] = i + j;
+            count += (bits >> j) & 1;
+        }
+    }
+#endif
+
+    for (; i < size; i++)
+    {
+        auto inside = true;
+
+        for (int j = 0; j < 6 && inside; j++)
+        {
+            inside = planes[j].x * corners[j][0][i] +
+                     planes[j].y * corners[j][1][i] +
+                     planes[j].z * corners[j][2][i] + planes[j].w >= 0.f;
+        }
+
+        visible[count] = i;
+        count += inside;
+    }
+
+    return count;
+}
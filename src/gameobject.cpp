@@ -1,142 +1,82 @@
 #include "gameobject.h"
 #include "abstract/component.h"
 #include "application.h"
-#include "material.h"
+#include "bvh.h"
 #include "mesh.h"
+#include "registry.h"
+#include "transformstorage.h"
 
-#include <glm/gtc/matrix_transform.hpp>
+using glm::angleAxis;
 using glm::mat4;
-using glm::rotate;
-using glm::scale;
-using glm::translate;
 using glm::vec3;
 
-#include <algorithm>
-#include <stdexcept>
-using std::logic_error;
-using std::vector;
-
-vector<GameObject *> GameObject::instances;
-
 GameObject::GameObject()
-    : parent(nullptr)
-    , model(1.f)
-    , mat_position(1.f)
-    , mat_rotation(1.f)
-    , mat_scale(1.f)
-    , materialComponent(nullptr)
-    , meshComponent(nullptr)
-    , dirty(false)
+    : transform(TransformStorage::Allocate())
 {
-    instances.push_back(this);
 }
 
 GameObject::~GameObject()
 {
-    instances.erase(find(instances.begin(), instances.end(), this));
-}
+    auto bvh = Application::GetBVH();
 
-void GameObject::AddComponent(Component *component)
-{
-    if (dynamic_cast<Material *>(component))
+    if (bvh && bvh->Contains(transform))
     {
-        if (materialComponent)
-        {
-            throw logic_error("Material is already attached to this object");
-        }
-
-        materialComponent = component;
+        bvh->Remove(transform);
     }
-    else if (dynamic_cast<Mesh *>(component))
-    {
-        if (meshComponent)
-        {
-            throw logic_error("Mesh is already attached to the object");
-        }
 
-        meshComponent = component;
-    }
-    else
-    {
-        throw logic_error("This component is not supported");
-    }
+    Registry::Remove(transform);
+    TransformStorage::Free(transform);
 }
 
-void GameObject::RemoveComponent(Component *component)
+void GameObject::AddComponent(Component *component)
 {
-    if (component == materialComponent)
-    {
-        materialComponent = nullptr;
-    }
-    else if (component == meshComponent)
-    {
-        meshComponent = nullptr;
-    }
-    else
-    {
-        throw logic_error("This component is not attached to this object");
-    }
+    component->Attach(transform);
 }
 
-mat4 GameObject::GetModelMatrix()
+void GameObject::RemoveComponent(Component *component)
 {
-    return model;
+    component->Detach(transform);
 }
 
-void GameObject::SetParent(const GameObject *parent)//, bool worldPositionStays)
+bool GameObject::GetBounds(vec3 &mins, vec3 &maxs) const
 {
-    this->parent = parent;
-    dirty = true;
+    auto &meshes = Registry::GetPool<const Mesh *>();
+
+    if (!meshes.Contains(transform))
+    {
+        return false;
+    }
+
+    meshes.Get(transform)->GetBounds(GetModelMatrix(), mins, maxs);
+    return true;
 }
 
-void GameObject::SetPosition(const vec3 &v)
+const mat4 &GameObject::GetModelMatrix() const
 {
-    mat_position = mat4(1.f);
-    mat_position = translate(mat_position, v);
-    dirty = true;
+    return TransformStorage::worlds[transform];
 }
 
-void GameObject::SetRotation(const vec3 &v)
+void GameObject::SetParent(const GameObject *parent)
 {
-    mat_rotation = mat4(1.f);
-    mat_rotation = rotate(mat_rotation, v.x, vec3(1.f, 0.f, 0.f));
-    mat_rotation = rotate(mat_rotation, v.y, vec3(0.f, 1.f, 0.f));
-    mat_rotation = rotate(mat_rotation, v.z, vec3(0.f, 0.f, 1.f));
-    dirty = true;
+    TransformStorage::SetParent(transform, parent ? parent->transform : TransformStorage::None);
 }
 
-void GameObject::SetScale(const vec3 &v)
+void GameObject::SetPosition(const vec3 &v)
 {
-    mat_scale = mat4(1.f);
-    mat_scale = scale(mat_scale, v);
-    dirty = true;
+    TransformStorage::positions[transform] = v;
+    TransformStorage::MarkDirty(transform);
 }
 
-void GameObject::Update()
+void GameObject::SetRotation(const vec3 &v)
 {
-    if (parent)
-    {
-        mat_position *= parent->mat_position;
-        mat_rotation *= parent->mat_rotation;
-        mat_scale *= parent->mat_scale;
-    }
-
-    model = mat_position *
-            mat_rotation *
-            mat_scale;
-    dirty = false;
+    TransformStorage::rotations[transform] = angleAxis(v.x, vec3(1.f, 0.f, 0.f)) *
+                                             angleAxis(v.y, vec3(0.f, 1.f, 0.f)) *
+                                             angleAxis(v.z, vec3(0.f, 0.f, 1.f));
+    TransformStorage::MarkDirty(transform);
 }
 
-void GameObject::Do()
+void GameObject::SetScale(const vec3 &v)
 {
-    if (dirty)
-    {
-        Update();
-    }
-
-    if (materialComponent && meshComponent)
-    {
-        materialComponent->Do(this);
-        meshComponent->Do(this);
-    }
+    TransformStorage::scales[transform] = v;
+    TransformStorage::MarkDirty(transform);
 }
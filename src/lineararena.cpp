@@ -0,0 +1,106 @@
+#include "lineararena.h"
+
+#include <algorithm>
+#include <new>
+using std::max;
+
+constexpr size_t LinearArena::DefaultBlockSize;
+
+LinearArena::LinearArena(size_t blockSize)
+    : block(nullptr)
+    , cursor(nullptr)
+    , end(nullptr)
+    , blockSize(blockSize)
+    , used(0)
+    , stats{0, 0, 0}
+{
+}
+
+LinearArena::~LinearArena()
+{
+    Release();
+}
+
+void *LinearArena::Allocate(size_t size, size_t alignment)
+{
+    auto address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+
+    if (!cursor || address + size > reinterpret_cast<uintptr_t>(end))
+    {
+        used += end - cursor;
+
+        // Requests larger than a block get a block of their own
+        AllocateBlock(max(blockSize, sizeof(Header) + size + alignment));
+
+        address = (reinterpret_cast<uintptr_t>(cursor) + alignment - 1) & ~(alignment - 1);
+    }
+
+    used += address + size - reinterpret_cast<uintptr_t>(cursor);
+    cursor = reinterpret_cast<uint8_t *>(address + size);
+
+    stats.allocations++;
+    stats.bytes += size;
+
+    return reinterpret_cast<void *>(address);
+}
+
+void LinearArena::Reset()
+{
+    if (!block)
+    {
+        return;
+    }
+
+    if (reinterpret_cast<Header *>(block)->previous)
+    {
+        size_t size = 0;
+
+        for (auto current = block; current; current = reinterpret_cast<Header *>(current)->previous)
+        {
+            size += reinterpret_cast<Header *>(current)->size - sizeof(Header);
+        }
+
+        Release();
+        AllocateBlock(sizeof(Header) + size);
+    }
+
+    cursor = block + sizeof(Header);
+    used = 0;
+}
+
+void LinearArena::Release()
+{
+    while (block)
+    {
+        auto previous = reinterpret_cast<Header *>(block)->previous;
+        ::operator delete(block);
+        block = previous;
+    }
+
+    cursor = nullptr;
+    end = nullptr;
+    used = 0;
+}
+
+size_t LinearArena::GetUsed() const
+{
+    return used;
+}
+
+LinearArenaStats LinearArena::GetStats() const
+{
+    return stats;
+}
+
+void LinearArena::AllocateBlock(size_t size)
+{
+    auto next = static_cast<uint8_t *>(::operator new(size));
+
+    reinterpret_cast<Header *>(next)->previous = block;
+    reinterpret_cast<Header *>(next)->size = size;
+    block = next;
+    cursor = next + sizeof(Header);
+    end = next + size;
+
+    stats.blocks++;
+}
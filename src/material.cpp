@@ -1,18 +1,19 @@
 #include "material.h"
 #include "application.h"
 #include "camera.h"
-#include "gameobject.h"
+#include "programcache.h"
+#include "registry.h"
 #include "texture.h"
 
 #include <glad.h>
 #include <glm/gtc/type_ptr.hpp>
+using glm::mat4;
 using glm::value_ptr;
 
 #include <stdexcept>
 using std::logic_error;
-using std::runtime_error;
 using std::string;
-using std::vector;
+using std::unordered_map;
 
 const char *vShaderCode =
 #include "shader.vs"
@@ -20,119 +21,167 @@ const char *vShaderCode =
 const char *fShaderCode =
 #include "shader.frag"
     ;
-uint32_t Material::shaderProgram;
-int32_t Material::mvpLocation[3];
 
-Material::Material()
+// Samplers live on fixed texture units, the index in this table
+static const struct
 {
-    if (!glIsProgram(shaderProgram))
-    {
-        int32_t success, logLength;
-        vector<char> log;
-        auto vShader = glCreateShader(GL_VERTEX_SHADER);
-        auto fShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(vShader, 1, &vShaderCode, nullptr);
-        glShaderSource(fShader, 1, &fShaderCode, nullptr);
-        glCompileShader(vShader);
-        glGetShaderiv(vShader, GL_COMPILE_STATUS, &success);
-
-        if (!success)
-        {
-            glGetShaderiv(vShader, GL_INFO_LOG_LENGTH, &logLength);
-            log.resize(logLength);
-            glGetShaderInfoLog(vShader, logLength, nullptr, log.data());
-            throw runtime_error(string("Failed to compile vertex shader:\n") + log.data());
-        }
+    const char *name;
+    ShaderFeature feature;
+} samplers[] =
+{
+    { "_MainTex", ShaderFeature::BaseTexture },
+    { "_LightmapTex", ShaderFeature::Lightmap }
+};
 
-        glCompileShader(fShader);
-        glGetShaderiv(fShader, GL_COMPILE_STATUS, &success);
+static const struct
+{
+    ShaderFeature feature;
+    const char *define;
+} defines[] =
+{
+    { ShaderFeature::Lightmap, "LIGHTMAP" },
+    { ShaderFeature::BaseTexture, "BASE_TEXTURE" },
+    { ShaderFeature::HDRDecode, "HDR_DECODE" },
+    { ShaderFeature::AlphaTest, "ALPHA_TEST" }
+};
+
+unordered_map<uint32_t, Material::Program> Material::programs;
+uint32_t Material::count;
+
+Material::Material(ShaderFeature features)
+    : id(count++)
+    , features(features)
+    , textures{nullptr, nullptr}
+    , program(nullptr)
+{
+}
+
+uint32_t Material::GetSortKey() const
+{
+    // Materials sharing a program end up next to each other
+    return static_cast<uint32_t>(features) << 24 | (id & 0xFFFFFF);
+}
 
-        if (!success)
+Texture *Material::GetTexture(string name)
+{
+    for (size_t i = 0; i < sizeof(samplers) / sizeof(samplers[0]); i++)
+    {
+        if (name == samplers[i].name && textures[i])
         {
-            glGetShaderiv(fShader, GL_INFO_LOG_LENGTH, &logLength);
-            log.resize(logLength);
-            glGetShaderInfoLog(fShader, logLength, nullptr, log.data());
-            throw runtime_error(string("Failed to compile fragment shader:\n") + log.data());
+            return textures[i];
         }
+    }
 
-        shaderProgram = glCreateProgram();
-        glAttachShader(shaderProgram, vShader);
-        glAttachShader(shaderProgram, fShader);
-        glLinkProgram(shaderProgram);
-        glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    throw logic_error("Texture not found");
+}
 
-        if (!success)
+void Material::SetTexture(string name, Texture *texture)
+{
+    for (size_t i = 0; i < sizeof(samplers) / sizeof(samplers[0]); i++)
+    {
+        if (name == samplers[i].name)
         {
-            glGetProgramiv(shaderProgram, GL_INFO_LOG_LENGTH, &logLength);
-            log.resize(logLength);
-            glGetProgramInfoLog(shaderProgram, logLength, nullptr, log.data());
-            throw runtime_error(string("Failed to link shader program:\n") + log.data());
+            textures[i] = texture;
+            SetFeature(samplers[i].feature, texture != nullptr);
+            return;
         }
-
-        glDeleteShader(vShader);
-        glDeleteShader(fShader);
-        mvpLocation[0] = glGetUniformLocation(shaderProgram, "model");
-        mvpLocation[1] = glGetUniformLocation(shaderProgram, "view");
-        mvpLocation[2] = glGetUniformLocation(shaderProgram, "projection");
     }
 
-    for (const auto &name :
-            { "_MainTex", "_LightmapTex"
-            })
-    {
-        SetTexture(name, new Texture(1, 1));
-    }
+    throw logic_error("Unable to attach texture to shader program");
 }
 
-Texture *Material::GetTexture(string name)
+ShaderFeature Material::GetFeatures() const
 {
-    auto textureLocation = glGetUniformLocation(shaderProgram, name.c_str());
+    return features;
+}
 
-    if (textureLocation != -1)
+void Material::SetFeature(ShaderFeature feature, bool enabled)
+{
+    features = enabled
+               ? features | feature
+               : features & ~feature;
+    program = nullptr;
+}
+
+void Material::Precompile(ShaderFeature features)
+{
+    GetProgram(features);
+}
+
+void Material::Bind() const
+{
+    if (!program)
     {
-        auto it = textures.find(textureLocation);
+        program = &GetProgram(features);
+    }
 
-        if (it != textures.end())
+    glUseProgram(program->name);
+
+    for (size_t i = 0; i < sizeof(samplers) / sizeof(samplers[0]); i++)
+    {
+        if (textures[i])
         {
-            return it->second;
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, textures[i]->name);
         }
     }
 
-    throw logic_error("Texture not found");
+    glUniformMatrix4fv(program->mvpLocation[1], 1, GL_FALSE, value_ptr(Application::GetCamera()->GetViewMatrix()));
+    glUniformMatrix4fv(program->mvpLocation[2], 1, GL_FALSE, value_ptr(Application::GetProjectionMatrix()));
 }
 
-void Material::SetTexture(string name, Texture *texture)
+void Material::SetModelMatrix(const mat4 &model) const
 {
-    auto textureLocation = glGetUniformLocation(shaderProgram, name.c_str());
+    glUniformMatrix4fv(program->mvpLocation[0], 1, GL_FALSE, value_ptr(model));
+}
 
-    if (textureLocation == -1)
+void Material::Attach(uint32_t entity)
+{
+    Registry::GetPool<const Material *>().Insert(entity, this);
+}
+
+void Material::Detach(uint32_t entity)
+{
+    Registry::GetPool<const Material *>().Remove(entity);
+}
+
+const Material::Program &Material::GetProgram(ShaderFeature features)
+{
+    auto it = programs.find(static_cast<uint32_t>(features));
+
+    if (it != programs.end())
     {
-        throw logic_error("Unable to attach texture to shader program");
+        return it->second;
     }
 
-    auto it = textures.find(textureLocation);
+    string header;
 
-    if (it != textures.end())
+    for (const auto &define : defines)
     {
-        textures.erase(it);
+        if ((features & define.feature) != ShaderFeature::None)
+        {
+            header += string("#define ") + define.define + "\n";
+        }
     }
 
-    textures.insert({textureLocation, texture});
-}
+    // Defines have to follow the #version directive
+    string vertexSource(vShaderCode);
+    string fragmentSource(fShaderCode);
+    vertexSource.insert(vertexSource.find('\n', vertexSource.find("#version")) + 1, header);
+    fragmentSource.insert(fragmentSource.find('\n', fragmentSource.find("#version")) + 1, header);
 
-void Material::Do(GameObject *caller)
-{
-    glUseProgram(shaderProgram);
-    int i = 0;
+    Program program;
+    program.name = ProgramCache::GetProgram(vertexSource, fragmentSource);
+    program.mvpLocation[0] = glGetUniformLocation(program.name, "model");
+    program.mvpLocation[1] = glGetUniformLocation(program.name, "view");
+    program.mvpLocation[2] = glGetUniformLocation(program.name, "projection");
+
+    glUseProgram(program.name);
 
-    for (auto it = textures.begin(); it != textures.end(); it++, i++)
+    for (size_t i = 0; i < sizeof(samplers) / sizeof(samplers[0]); i++)
     {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, it->second->name);
-        glUniform1i(it->first, i);
+        glUniform1i(glGetUniformLocation(program.name, samplers[i].name), i);
     }
 
-    glUniformMatrix4fv(mvpLocation[0], 1, GL_FALSE, value_ptr(caller->GetModelMatrix()));
-    glUniformMatrix4fv(mvpLocation[1], 1, GL_FALSE, value_ptr(Application::GetCamera()->GetViewMatrix()));
-    glUniformMatrix4fv(mvpLocation[2], 1, GL_FALSE, value_ptr(Application::GetProjectionMatrix()));
+    return programs.insert({static_cast<uint32_t>(features), program}).first->second;
 }
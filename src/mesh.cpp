@@ -1,42 +1,149 @@
 #include "mesh.h"
+#include "application.h"
+#include "bvh.h"
+#include "mesharena.h"
+#include "registry.h"
+#include "transformstorage.h"
 
 #include <glad.h>
+#include <glm/gtc/matrix_transform.hpp>
+using glm::abs;
+using glm::clamp;
+using glm::mat3;
+using glm::mat4;
+using glm::max;
+using glm::min;
+using glm::packHalf2x16;
+using glm::packUnorm2x16;
+using glm::round;
+using glm::scale;
+using glm::translate;
 using glm::vec2;
 using glm::vec3;
+using glm::vec4;
+
+#include <limits>
+#include <stdexcept>
+using std::logic_error;
+using std::numeric_limits;
 
 using std::vector;
 
 Mesh::Mesh(const std::vector<uint32_t> &indices,
-           const std::vector<Vertex> &vertexes)
-    : indicesCount(indices.size())
-{
-    glGenVertexArrays(1, &vao);
-    glGenBuffers(1, &vbo);
-    glGenBuffers(1, &ebo);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, vertexes.size() * sizeof(Vertex), vertexes.data(), GL_STATIC_DRAW);
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, position));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, uv1));
-    glEnableVertexAttribArray(2);
-    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, uv2));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
-    glBindVertexArray(0);
+           const std::vector<Vertex> &vertexes,
+           VertexFormat format)
+    : Mesh(indices.data(), indices.size(), vertexes.data(), vertexes.size(), format)
+{
+}
+
+Mesh::Mesh(const uint32_t *indices, size_t indicesCount,
+           const Vertex *vertexes, size_t vertexCount,
+           VertexFormat format)
+    : vertexCount(vertexCount)
+    , indicesCount(indicesCount)
+    , format(format)
+    , mins(numeric_limits<float>::max())
+    , maxs(-numeric_limits<float>::max())
+{
+    // The bounds would stay inverted and reach the BVH
+    if (!vertexCount)
+    {
+        throw logic_error("Mesh has no vertexes");
+    }
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        mins = min(mins, vertexes[i].position);
+        maxs = max(maxs, vertexes[i].position);
+    }
+
+    arena = MeshArena::Get(format);
+
+    switch (format)
+    {
+    case VertexFormat::Float:
+    {
+        arena->Allocate(vertexes, vertexCount, indices, indicesCount, baseVertex, firstIndex);
+    }
+    break;
+
+    case VertexFormat::Packed:
+    {
+        auto decode = GetDecodeMatrix();
+        auto extent = vec3(decode[0][0], decode[1][1], decode[2][2]);
+        vector<PackedVertex> packed(vertexCount);
+
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            auto position = round(clamp((vertexes[i].position - mins) / extent, 0.f, 1.f) * 65535.f);
+            packed[i].position[0] = static_cast<uint16_t>(position.x);
+            packed[i].position[1] = static_cast<uint16_t>(position.y);
+            packed[i].position[2] = static_cast<uint16_t>(position.z);
+            packed[i].position[3] = 0;
+            packed[i].uv1 = packHalf2x16(vertexes[i].uv1);
+            packed[i].uv2 = packUnorm2x16(vertexes[i].uv2);
+        }
+
+        arena->Allocate(packed.data(), vertexCount, indices, indicesCount, baseVertex, firstIndex);
+    }
+    break;
+    }
 }
 
 Mesh::~Mesh()
 {
-    glDeleteVertexArrays(1, &vao);
-    glDeleteBuffers(1, &vbo);
-    glDeleteBuffers(1, &ebo);
+    arena->Free(baseVertex, vertexCount, firstIndex, indicesCount);
+}
+
+void Mesh::GetBounds(vec3 &mins, vec3 &maxs) const
+{
+    mins = this->mins;
+    maxs = this->maxs;
 }
 
-void Mesh::Do(GameObject *)
+void Mesh::GetBounds(const mat4 &model, vec3 &mins, vec3 &maxs) const
 {
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, indicesCount, GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+    auto center = vec3(model * vec4((this->mins + this->maxs) * .5f, 1.f));
+    auto extents = abs(mat3(model)) * ((this->maxs - this->mins) * .5f);
+
+    mins = center - extents;
+    maxs = center + extents;
+}
+
+mat4 Mesh::GetDecodeMatrix() const
+{
+    if (format == VertexFormat::Float)
+    {
+        return mat4(1.f);
+    }
+
+    // Flat meshes still need a non-zero scale on every axis
+    auto extent = max(maxs - mins, vec3(numeric_limits<float>::epsilon()));
+    return scale(translate(mat4(1.f), mins), extent);
+}
+
+void Mesh::Draw() const
+{
+    glDrawElementsBaseVertex(GL_TRIANGLES, indicesCount, GL_UNSIGNED_INT,
+                             (void *)(firstIndex * sizeof(uint32_t)), baseVertex);
+}
+
+void Mesh::Attach(uint32_t entity)
+{
+    Registry::GetPool<const Mesh *>().Insert(entity, this);
+
+    // The bounds are placed in the scene tree with the next transform update
+    TransformStorage::MarkDirty(entity);
+}
+
+void Mesh::Detach(uint32_t entity)
+{
+    Registry::GetPool<const Mesh *>().Remove(entity);
+
+    auto bvh = Application::GetBVH();
+
+    if (bvh && bvh->Contains(entity))
+    {
+        bvh->Remove(entity);
+    }
 }
@@ -0,0 +1,286 @@
+#include "mesharena.h"
+#include "mesh.h"
+
+#include <glad.h>
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+using std::max;
+using std::prev;
+using std::runtime_error;
+
+constexpr size_t InitialVertexes = 1 << 16;
+constexpr size_t InitialIndices = 1 << 18;
+
+FreeList::FreeList(size_t capacity)
+    : capacity(capacity)
+    , used(0)
+{
+    blocks[0] = capacity;
+}
+
+bool FreeList::Allocate(size_t size, size_t &offset)
+{
+    if (!size)
+    {
+        offset = 0;
+        return true;
+    }
+
+    for (auto it = blocks.begin(); it != blocks.end(); it++)
+    {
+        if (it->second < size)
+        {
+            continue;
+        }
+
+        offset = it->first;
+
+        if (it->second > size)
+        {
+            blocks[it->first + size] = it->second - size;
+        }
+
+        blocks.erase(it);
+        used += size;
+        return true;
+    }
+
+    return false;
+}
+
+void FreeList::Free(size_t offset, size_t size)
+{
+    if (!size)
+    {
+        return;
+    }
+
+    used -= size;
+
+    auto next = blocks.lower_bound(offset);
+
+    if (next != blocks.end() && offset + size == next->first)
+    {
+        size += next->second;
+        next = blocks.erase(next);
+    }
+
+    if (next != blocks.begin())
+    {
+        auto previous = prev(next);
+
+        if (previous->first + previous->second == offset)
+        {
+            previous->second += size;
+            return;
+        }
+    }
+
+    blocks[offset] = size;
+}
+
+void FreeList::Grow(size_t newCapacity)
+{
+    auto size = newCapacity - capacity;
+    auto offset = capacity;
+    capacity = newCapacity;
+    used += size;
+    Free(offset, size);
+}
+
+size_t FreeList::GetCapacity() const
+{
+    return capacity;
+}
+
+size_t FreeList::GetUsed() const
+{
+    return used;
+}
+
+size_t FreeList::GetFreeBlocks() const
+{
+    return blocks.size();
+}
+
+size_t FreeList::GetLargestFreeBlock() const
+{
+    size_t largest = 0;
+
+    for (const auto &block : blocks)
+    {
+        largest = max(largest, block.second);
+    }
+
+    return largest;
+}
+
+MeshArena *MeshArena::arenas[2];
+
+MeshArena::MeshArena(VertexFormat format)
+    : format(format)
+    , stride(format == VertexFormat::Packed ? sizeof(PackedVertex) : sizeof(Vertex))
+    , vertexes(InitialVertexes)
+    , indices(InitialIndices)
+{
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vbo);
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, InitialVertexes * stride, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferData(GL_COPY_WRITE_BUFFER, InitialIndices * sizeof(uint32_t), nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    SetupAttributes();
+}
+
+MeshArena::~MeshArena()
+{
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+}
+
+MeshArena *MeshArena::Get(VertexFormat format)
+{
+    auto &arena = arenas[static_cast<int>(format)];
+
+    if (!arena)
+    {
+        arena = new MeshArena(format);
+    }
+
+    return arena;
+}
+
+void MeshArena::Release()
+{
+    for (auto &arena : arenas)
+    {
+        delete arena;
+        arena = nullptr;
+    }
+}
+
+void MeshArena::Allocate(const void *vertexData, size_t vertexCount, const uint32_t *indexData, size_t indexCount,
+                         size_t &baseVertex, size_t &firstIndex)
+{
+    if (!vertexes.Allocate(vertexCount, baseVertex))
+    {
+        auto capacity = vertexes.GetCapacity();
+        auto newCapacity = max(capacity * 2, capacity + vertexCount);
+        Resize(vbo, capacity * stride, newCapacity * stride);
+        vertexes.Grow(newCapacity);
+        SetupAttributes();
+
+        if (!vertexes.Allocate(vertexCount, baseVertex))
+        {
+            throw runtime_error("Failed to allocate vertex memory");
+        }
+    }
+
+    if (!indices.Allocate(indexCount, firstIndex))
+    {
+        auto capacity = indices.GetCapacity();
+        auto newCapacity = max(capacity * 2, capacity + indexCount);
+        Resize(ebo, capacity * sizeof(uint32_t), newCapacity * sizeof(uint32_t));
+        indices.Grow(newCapacity);
+        SetupAttributes();
+
+        if (!indices.Allocate(indexCount, firstIndex))
+        {
+            throw runtime_error("Failed to allocate index memory");
+        }
+    }
+
+    // Uploads go through the copy target, so that the bound vertex array
+    // object is left alone
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, baseVertex * stride, vertexCount * stride, vertexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, firstIndex * sizeof(uint32_t), indexCount * sizeof(uint32_t), indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void MeshArena::Free(size_t baseVertex, size_t vertexCount, size_t firstIndex, size_t indexCount)
+{
+    vertexes.Free(baseVertex, vertexCount);
+    indices.Free(firstIndex, indexCount);
+}
+
+void MeshArena::Bind() const
+{
+    glBindVertexArray(vao);
+}
+
+ArenaStats MeshArena::GetVertexStats() const
+{
+    return GetStats(vertexes);
+}
+
+ArenaStats MeshArena::GetIndexStats() const
+{
+    return GetStats(indices);
+}
+
+void MeshArena::SetupAttributes()
+{
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+    glEnableVertexAttribArray(2);
+
+    switch (format)
+    {
+    case VertexFormat::Float:
+    {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, position));
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, uv1));
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void *)offsetof(Vertex, uv2));
+    }
+    break;
+
+    case VertexFormat::Packed:
+    {
+        glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *)offsetof(PackedVertex, position));
+        glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *)offsetof(PackedVertex, uv1));
+        glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void *)offsetof(PackedVertex, uv2));
+    }
+    break;
+    }
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+}
+
+void MeshArena::Resize(uint32_t &buffer, size_t oldSize, size_t newSize)
+{
+    uint32_t newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newSize, nullptr, GL_STATIC_DRAW);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    buffer = newBuffer;
+}
+
+ArenaStats MeshArena::GetStats(const FreeList &list)
+{
+    auto free = list.GetCapacity() - list.GetUsed();
+
+    return
+    {
+        list.GetCapacity(),
+        list.GetUsed(),
+        list.GetFreeBlocks(),
+        free
+        ? 1.f - static_cast<float>(list.GetLargestFreeBlock()) / free
+        : 0.f
+    };
+}
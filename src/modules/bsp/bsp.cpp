@@ -2,12 +2,19 @@
 #include "gameobject.h"
 #include "material.h"
 #include "mesh.h"
+#include "occluder.h"
 #include "texture.h"
+#include "threadpool.h"
 
+using glm::abs;
 using glm::clamp;
 using glm::distance;
 using glm::dot;
+using glm::floor;
+using glm::ivec3;
+using glm::min;
 using glm::pow;
+using glm::uvec2;
 using glm::vec2;
 using glm::vec3;
 
@@ -17,23 +24,60 @@ using boost::is_any_of;
 using boost::split;
 using boost::trim_if;
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <regex>
 #include <stdexcept>
+#include <tuple>
+using std::copy;
+using std::fill;
 using std::ifstream;
+using std::make_shared;
+using std::make_tuple;
+using std::pair;
 using std::numeric_limits;
 using std::regex;
 using std::runtime_error;
+using std::shared_ptr;
+using std::sort;
 using std::sregex_iterator;
 using std::stoi;
 using std::stof;
 using std::string;
+using std::tuple;
 using std::vector;
 using std::unordered_map;
 
 // Inches to Meters
 constexpr float Worldscale = 0.0254f;
 
+// World geometry is split into cubes of this size, in inches,
+// so that each part can be culled on its own
+constexpr float ClusterSize = 1024.f;
+
+// Faces larger than this, in square inches, are used as occluders
+constexpr float OccluderArea = 128.f * 128.f;
+
+// Lightmap atlases spill into more pages beyond this size, in luxels
+constexpr uint32_t LightmapPageSize = 4096;
+
+// Traces stop this far from the planes they hit, in inches
+constexpr float DistEpsilon = 1.f / 32.f;
+
+// State of one trace through the tree, in map space
+struct TraceWork
+{
+    vec3 start, end;
+    vec3 extents;
+    bool isPoint;
+    int32_t mask;
+    TraceResult result;
+    const dplane_t *plane;
+};
+
 void BSP::LoadBSPFile(string filename, bool bHDR)
 {
     pFile.open(filename, ifstream::in | ifstream::binary);
@@ -67,14 +111,40 @@ void BSP::LoadBSPFile(string filename, bool bHDR)
     CopyLump(LUMP_SURFEDGES, dsurfedges);
     CopyLump(LUMP_TEXDATA_STRING_DATA, g_TexDataStringData);
     CopyLump(LUMP_TEXDATA_STRING_TABLE, g_TexDataStringTable);
+    CopyLump(LUMP_PLANES, dplanes);
+    CopyLump(LUMP_NODES, dnodes);
+    CopyLump(LUMP_LEAFBRUSHES, dleafbrushes);
+    CopyLump(LUMP_BRUSHES, dbrushes);
+    CopyLump(LUMP_BRUSHSIDES, dbrushsides);
+
+    if (g_pBSPHeader.lumps[LUMP_LEAFS].version == 0)
+    {
+        vector<dleaf_version_0_t> leafs;
+        CopyLump(LUMP_LEAFS, leafs);
+
+        dleafs.resize(leafs.size());
+
+        for (size_t i = 0; i < leafs.size(); i++)
+        {
+            memcpy(&dleafs[i], &leafs[i], offsetof(dleaf_t, leafWaterDataID) + sizeof(int16_t));
+        }
+    }
+    else
+    {
+        CopyLump(LUMP_LEAFS, dleafs);
+    }
 
     pFile.close();
 
+    worldHeadnode = dmodels.empty() ? -1 : dmodels[0].headnode;
+
     root = new GameObject;
     root->SetScale(vec3(Worldscale));
 
     ParseEntities();
 
+    arena.Release();
+
     dmodels.clear();
     dlightdata.clear();
     dentdata.clear();
@@ -141,13 +211,20 @@ void BSP::ParseEntities()
         {
             vector<string> origin;
             split(origin, data["origin"], is_any_of(" "));
-            object->SetPosition(FlipVector(vec3(stof(origin[0]), stof(origin[1]), stof(origin[2]))) * Worldscale);
+            object->SetPosition(FlipVector(vec3(stof(origin[0]), stof(origin[1]), stof(origin[2]))));
         }
 
         object->SetParent(root);
     }
 }
 
+Surface::Surface(int index, LinearArena &arena)
+    : index(index)
+    , indices(arena)
+    , vertexes(arena)
+{
+}
+
 Surface BSP::BuildFace(int index)
 {
     if (dfaces[index].dispinfo != -1)
@@ -155,8 +232,9 @@ Surface BSP::BuildFace(int index)
         return BuildDisplacement(index);
     }
 
-    Surface surface;
-    surface.index = index;
+    Surface surface(index, arena);
+    surface.indices.reserve((dfaces[index].numedges - 2) * 3);
+    surface.vertexes.reserve(dfaces[index].numedges);
 
     for (int i = 1; i < dfaces[index].numedges - 1; i++)
     {
@@ -202,10 +280,10 @@ Surface BSP::BuildFace(int index)
 
 Surface BSP::BuildDisplacement(int index)
 {
-    Surface surface;
-    surface.index = index;
+    Surface surface(index, arena);
 
-    vector<vec3> vertexes;
+    LinearVector<vec3> vertexes(arena);
+    vertexes.reserve(dfaces[index].numedges);
 
     for (int i = dfaces[index].firstedge; i < dfaces[index].firstedge + dfaces[index].numedges; i++)
     {
@@ -246,6 +324,9 @@ Surface BSP::BuildDisplacement(int index)
 
     auto lightdelta = 1.f / (numEdgeVertices - 1);
 
+    surface.vertexes.reserve(numEdgeVertices * numEdgeVertices);
+    surface.indices.reserve((numEdgeVertices - 1) * (numEdgeVertices - 1) * 6);
+
     auto leftEdgeStep = leftEdge * subdivideScale;
     auto rightEdgeStep = rightEdge * subdivideScale;
 
@@ -327,66 +408,194 @@ GameObject *BSP::BuildModel(int index)
 {
     auto model = new GameObject;
 
-    unordered_map<int, vector<int>> dict;
+    // Faces sorted by material and cluster, the face index ends the key so
+    // faces of a group keep their order
+    LinearVector<pair<tuple<int32_t, int32_t, int32_t, int32_t>, int>> faces(arena);
+    faces.reserve(dmodels[index].numfaces);
 
     for (int i = dmodels[index].firstface; i < dmodels[index].firstface + dmodels[index].numfaces; i++)
     {
-        dict[dtexdata[texinfo[dfaces[i].texinfo].texdata].nameStringTableID].push_back(i);
+        auto cluster = index == 0
+                       ? GetFaceCluster(i)
+                       : ivec3(0);
+
+        faces.push_back(
+        {
+            make_tuple(dtexdata[texinfo[dfaces[i].texinfo].texdata].nameStringTableID,
+                       cluster.x,
+                       cluster.y,
+                       cluster.z),
+            i
+        });
     }
 
-    for (size_t i = 0; i < g_TexDataStringTable.size(); i++)
+    sort(faces.begin(), faces.end());
+
+    LinearVector<vec3> occluder(arena);
+
+    for (size_t first = 0, last; first < faces.size(); first = last)
     {
-        if (dict.find(i) == dict.end())
+        last = first + 1;
+
+        while (last < faces.size() && faces[last].first == faces[first].first)
         {
-            continue;
+            last++;
         }
 
-        vector<uint32_t> indices;
-        vector<Vertex> vertexes;
-        vector<Surface> surfaces;
+        LinearVector<Surface> surfaces(arena);
+        surfaces.reserve(last - first);
 
-        for (size_t j = 0; j < dict[i].size(); j++)
+        for (size_t j = first; j < last; j++)
         {
-            if (texinfo[dfaces[dict[i][j]].texinfo].flags & (SURF_SKY | SURF_NODRAW | SURF_HINT | SURF_SKIP))
+            if (texinfo[dfaces[faces[j].second].texinfo].flags & (SURF_SKY | SURF_NODRAW | SURF_HINT | SURF_SKIP))
             {
                 continue;
             }
 
-            surfaces.push_back(BuildFace(dict[i][j]));
+            surfaces.push_back(BuildFace(faces[j].second));
+            WrapTextureCoords(surfaces.back());
         }
 
-        auto submesh = new GameObject;
-        submesh->SetParent(model);
+        LinearVector<uint32_t> pages(arena);
+        auto lightmaps = PackLightmaps(surfaces, pages);
 
-        auto lightmap = PackLightmaps(surfaces);
-
-        for (const auto &surface : surfaces)
+        // One mesh for each lightmap page
+        for (size_t page = 0; page < std::max<size_t>(lightmaps.size(), 1); page++)
         {
-            auto pointOffset = vertexes.size();
+            size_t indicesCount = 0, vertexCount = 0;
+
+            for (size_t j = 0; j < surfaces.size(); j++)
+            {
+                if (pages[j] == page)
+                {
+                    indicesCount += surfaces[j].indices.size();
+                    vertexCount += surfaces[j].vertexes.size();
+                }
+            }
 
-            for (size_t k = 0; k < surface.indices.size(); k++)
+            if (!vertexCount)
             {
-                indices.push_back(surface.indices[k] + pointOffset);
+                continue;
             }
 
-            vertexes.insert(vertexes.end(), surface.vertexes.begin(), surface.vertexes.end());
-        }
+            LinearVector<uint32_t> indices(arena);
+            LinearVector<Vertex> vertexes(arena);
+            indices.reserve(indicesCount);
+            vertexes.reserve(vertexCount);
+
+            for (size_t j = 0; j < surfaces.size(); j++)
+            {
+                const auto &surface = surfaces[j];
+
+                if (pages[j] != page)
+                {
+                    continue;
+                }
 
-        auto material = new Material;
-        auto mesh = new Mesh(indices, vertexes);
+                auto pointOffset = vertexes.size();
+
+                for (size_t k = 0; k < surface.indices.size(); k++)
+                {
+                    indices.push_back(surface.indices[k] + pointOffset);
+                }
 
-        material->SetTexture("_LightmapTex", lightmap);
+                vertexes.insert(vertexes.end(), surface.vertexes.begin(), surface.vertexes.end());
 
-        submesh->AddComponent(material);
-        submesh->AddComponent(mesh);
+                if (index == 0 &&
+                        dfaces[surface.index].dispinfo == -1 &&
+                        dfaces[surface.index].area >= OccluderArea &&
+                        !(texinfo[dfaces[surface.index].texinfo].flags & SURF_TRANS))
+                {
+                    for (size_t k = 0; k < surface.indices.size(); k++)
+                    {
+                        occluder.push_back(surface.vertexes[surface.indices[k]].position);
+                    }
+                }
+            }
+
+            auto submesh = new GameObject;
+            submesh->SetParent(model);
+
+            auto material = new Material;
+            auto mesh = new Mesh(indices.data(), indices.size(), vertexes.data(), vertexes.size(), VertexFormat::Packed);
+
+            // Drawn without the lightmap until its page is uploaded
+            if (!lightmaps.empty())
+            {
+                auto handle = material->GetHandle();
+
+                lightmaps[page]->OnComplete([handle](Texture *lightmap)
+                {
+                    if (auto material = ResourcePool<Material>::Get(handle))
+                    {
+                        material->SetTexture("_LightmapTex", lightmap);
+                    }
+                });
+            }
+
+            submesh->AddComponent(material);
+            submesh->AddComponent(mesh);
+        }
+    }
+
+    if (!occluder.empty())
+    {
+        model->AddComponent(new Occluder(occluder.data(), occluder.size()));
     }
 
     return model;
 }
 
-Texture *BSP::PackLightmaps(vector<Surface> &surfaces)
+void BSP::WrapTextureCoords(Surface &surface)
 {
-    vector<Texture *> lightmaps;
+    // Textures repeat, so moving a face by whole tiles keeps its
+    // coordinates small enough for half floats
+    auto offset = vec2(numeric_limits<float>::max());
+
+    for (const auto &vertex : surface.vertexes)
+    {
+        offset = min(offset, vertex.uv1);
+    }
+
+    offset = floor(offset);
+
+    for (auto &vertex : surface.vertexes)
+    {
+        vertex.uv1 -= offset;
+    }
+}
+
+ivec3 BSP::GetFaceCluster(int index)
+{
+    vec3 center(0.f);
+
+    for (int i = dfaces[index].firstedge; i < dfaces[index].firstedge + dfaces[index].numedges; i++)
+    {
+        center += dsurfedges[i] > 0
+                  ? dvertexes[dedges[abs(dsurfedges[i])].v[0]]
+                  : dvertexes[dedges[abs(dsurfedges[i])].v[1]];
+    }
+
+    center /= static_cast<float>(dfaces[index].numedges);
+
+    return ivec3(floor(center / ClusterSize));
+}
+
+uvec2 BSP::GetLightmapSize(int index) const
+{
+    return uvec2(dfaces[index].m_LightmapTextureSizeInLuxels[0] + 1,
+                 dfaces[index].m_LightmapTextureSizeInLuxels[1] + 1);
+}
+
+vector<AssetHandle<Texture>> BSP::PackLightmaps(LinearVector<Surface> &surfaces, LinearVector<uint32_t> &pages)
+{
+    pages.assign(surfaces.size(), 0);
+
+    // Only the sizes are packed, the texels are decoded straight into
+    // the pages afterwards. They are padded to whole DXT1 blocks, so that
+    // no block mixes the light of two faces.
+    vector<uvec2> sizes;
+    sizes.reserve(surfaces.size());
 
     for (const auto &surface : surfaces)
     {
@@ -395,29 +604,29 @@ Texture *BSP::PackLightmaps(vector<Surface> &surfaces)
             continue;
         }
 
-        auto lightmap = new Texture(dfaces[surface.index].m_LightmapTextureSizeInLuxels[0] + 1,
-                                    dfaces[surface.index].m_LightmapTextureSizeInLuxels[1] + 1);
-        auto color = (ColorRGBExp32 *)(dlightdata.data() + dfaces[surface.index].lightofs);
-
-        for (uintmax_t i = 0; i < lightmap->GetArea(); i++)
-        {
-            lightmap->SetPixel(i, Color(clamp<int>(color[i].r * pow(2, color[i].exponent), 0, 255),
-                                        clamp<int>(color[i].g * pow(2, color[i].exponent), 0, 255),
-                                        clamp<int>(color[i].b * pow(2, color[i].exponent), 0, 255),
-                                        255));
-        }
+        sizes.push_back((GetLightmapSize(surface.index) + uvec2(3u)) / uvec2(4u) * uvec2(4u));
+    }
 
-        lightmaps.push_back(lightmap);
+    // Leaves the material without the lightmap feature
+    if (sizes.empty())
+    {
+        return {};
     }
 
-    auto atlas = new Texture(1, 1);
-    auto rc = atlas->PackTextures(lightmaps);
+    vector<AtlasRect> rects;
+    auto sizesOfPages = Texture::PackRects(sizes, rects, LightmapPageSize);
+
+    // The pages outlive the lump, which is dropped once the file is loaded
+    vector<shared_ptr<vector<uint8_t>>> texels(sizesOfPages.size());
 
-    for (size_t i = 0; i < lightmaps.size(); i++)
+    for (size_t i = 0; i < texels.size(); i++)
     {
-        delete lightmaps[i];
+        texels[i] = make_shared<vector<uint8_t>>(sizesOfPages[i] * sizesOfPages[i] * sizeof(Color));
     }
 
+    // Rects follow the sizes, which skip unlit surfaces
+    size_t lightmap = 0;
+
     for (size_t i = 0; i < surfaces.size(); i++)
     {
         if (dfaces[surfaces[i].index].lightofs == -1)
@@ -425,21 +634,103 @@ Texture *BSP::PackLightmaps(vector<Surface> &surfaces)
             continue;
         }
 
+        const auto &rect = rects[lightmap++];
+        auto luxels = GetLightmapSize(surfaces[i].index);
+        auto size = sizesOfPages[rect.page];
+        auto page = reinterpret_cast<Color *>(texels[rect.page]->data());
+        auto color = (ColorRGBExp32 *)(dlightdata.data() + dfaces[surfaces[i].index].lightofs);
+
+        pages[i] = rect.page;
+
+        for (uint32_t y = 0; y < rect.rect.size.y; y++)
+        {
+            auto row = page + (rect.rect.position.y + y) * size + rect.rect.position.x;
+
+            // The padding repeats the edge luxels, filtering at the edge of
+            // the face stays within its own light
+            if (y >= luxels.y)
+            {
+                copy(row - size, row - size + rect.rect.size.x, row);
+                continue;
+            }
+
+            for (uint32_t x = 0; x < luxels.x; x++, color++)
+            {
+                row[x] = Color(clamp<int>(color->r * pow(2, color->exponent), 0, 255),
+                               clamp<int>(color->g * pow(2, color->exponent), 0, 255),
+                               clamp<int>(color->b * pow(2, color->exponent), 0, 255),
+                               255);
+            }
+
+            fill(row + luxels.x, row + rect.rect.size.x, row[luxels.x - 1]);
+        }
+
         for (size_t j = 0; j < surfaces[i].vertexes.size(); j++)
         {
-            auto x = surfaces[i].vertexes[j].uv2.x * rc[i].size.x + rc[i].position.x;
-            auto y = surfaces[i].vertexes[j].uv2.y * rc[i].size.y + rc[i].position.y;
+            auto x = surfaces[i].vertexes[j].uv2.x * luxels.x + rect.rect.position.x;
+            auto y = surfaces[i].vertexes[j].uv2.y * luxels.y + rect.rect.position.y;
 
-            x /= atlas->GetWidth();
-            y /= atlas->GetHeight();
+            x /= size;
+            y /= size;
 
             surfaces[i].vertexes[j].uv2 = vec2(x, y);
         }
     }
 
-    atlas->Apply(false);
+    vector<AssetHandle<Texture>> atlases(sizesOfPages.size());
+
+    for (size_t i = 0; i < atlases.size(); i++)
+    {
+        auto size = sizesOfPages[i];
+        auto page = texels[i];
+        uint32_t levels = 1;
+
+        while (size >> levels)
+        {
+            levels++;
+        }
+
+        // Lightmaps are opaque, DXT1 takes an eighth of the memory. Pages
+        // are filtered down and compressed on the thread pool, every level
+        // after the previous one, and uploaded as they are done.
+        atlases[i] = AssetManager::Request<Texture, vector<uint8_t>>([size, page]() -> vector<uint8_t>
+        {
+            auto blockSize = BlockEncoder::GetBlockSize(TextureFormat::DXT1);
+            vector<uint8_t> blocks, level, next;
+            auto levelTexels = page->data();
+
+            for (auto levelSize = size; ; levelSize /= 2)
+            {
+                auto offset = blocks.size();
+                blocks.resize(offset + (levelSize + 3) / 4 * ((levelSize + 3) / 4) * blockSize);
+                BlockEncoder::Encode(levelTexels, levelSize, levelSize, TextureFormat::DXT1, CompressionQuality::Normal,
+                                     blocks.data() + offset);
+
+                if (levelSize == 1)
+                {
+                    return blocks;
+                }
+
+                next.resize(levelSize / 2 * (levelSize / 2) * sizeof(Color));
+                Texture::DownsampleBox(levelTexels, levelSize, levelSize, sizeof(Color), next.data());
+                level.swap(next);
+                levelTexels = level.data();
+            }
+        }, [size, levels](vector<uint8_t> &blocks) -> Texture *
+        {
+            auto atlas = new Texture(size, size, TextureFormat::DXT1);
+            atlas->LoadRawTextureData(reinterpret_cast<const uintptr_t *>(blocks.data()), levels);
+            atlas->Apply(true);
+            return atlas;
+        });
+    }
+
+    return atlases;
+}
 
-    return atlas;
+LinearArenaStats BSP::GetLoadStats() const
+{
+    return arena.GetStats();
 }
 
 template<typename T>
@@ -454,3 +745,274 @@ vec3 BSP::FlipVector(const vec3 &v)
 {
     return vec3(v.x, v.z, -v.y);
 }
+
+vec3 BSP::UnflipVector(const vec3 &v)
+{
+    return vec3(v.x, -v.z, v.y);
+}
+
+TraceResult BSP::TraceLine(const vec3 &start, const vec3 &end, int32_t mask) const
+{
+    return TraceBox(start, end, vec3(0.f), vec3(0.f), mask);
+}
+
+TraceResult BSP::TraceBox(const vec3 &start, const vec3 &end, const vec3 &mins, const vec3 &maxs, int32_t mask) const
+{
+    // The box is traced from its center, in the space of the map
+    auto offset = UnflipVector((mins + maxs) * .5f) / Worldscale;
+
+    TraceWork work;
+    work.start = UnflipVector(start) / Worldscale + offset;
+    work.end = UnflipVector(end) / Worldscale + offset;
+    work.extents = abs(UnflipVector((maxs - mins) * .5f)) / Worldscale;
+    work.isPoint = work.extents.x == 0.f && work.extents.y == 0.f && work.extents.z == 0.f;
+    work.mask = mask;
+    work.result.fraction = 1.f;
+    work.result.contents = CONTENTS_EMPTY;
+    work.result.startSolid = false;
+    work.result.allSolid = false;
+    work.plane = nullptr;
+
+    if (worldHeadnode >= 0)
+    {
+        RecursiveHullCheck(work, worldHeadnode, 0.f, 1.f, work.start, work.end);
+    }
+
+    auto &result = work.result;
+    result.end = FlipVector(work.start + (work.end - work.start) * result.fraction - offset) * Worldscale;
+
+    if (work.plane)
+    {
+        result.normal = FlipVector(work.plane->normal);
+        result.distance = work.plane->dist * Worldscale;
+    }
+    else
+    {
+        result.normal = vec3(0.f);
+        result.distance = 0.f;
+    }
+
+    return result;
+}
+
+void BSP::TraceBatch(const vector<TraceRequest> &requests, vector<TraceResult> &results) const
+{
+    results.resize(requests.size());
+
+    ThreadPool::ParallelFor(requests.size(), [&](size_t begin, size_t end)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            const auto &request = requests[i];
+            results[i] = TraceBox(request.start, request.end, request.mins, request.maxs, request.mask);
+        }
+    });
+}
+
+void BSP::RecursiveHullCheck(TraceWork &work, int32_t num, float p1f, float p2f, const vec3 &p1, const vec3 &p2) const
+{
+    // Something nearer was already hit
+    if (work.result.fraction <= p1f)
+    {
+        return;
+    }
+
+    if (num < 0)
+    {
+        TraceToLeaf(work, -1 - num);
+        return;
+    }
+
+    const auto &node = dnodes[num];
+    const auto &plane = dplanes[node.planenum];
+
+    // Distances of both ends to the plane, and how far the box reaches
+    // along its normal
+    float t1, t2, offset;
+
+    if (plane.type < 3)
+    {
+        t1 = p1[plane.type] - plane.dist;
+        t2 = p2[plane.type] - plane.dist;
+        offset = work.extents[plane.type];
+    }
+    else
+    {
+        t1 = dot(plane.normal, p1) - plane.dist;
+        t2 = dot(plane.normal, p2) - plane.dist;
+        offset = work.isPoint ? 0.f : dot(abs(plane.normal), work.extents);
+    }
+
+    if (t1 >= offset + 1.f && t2 >= offset + 1.f)
+    {
+        RecursiveHullCheck(work, node.children[0], p1f, p2f, p1, p2);
+        return;
+    }
+
+    if (t1 < -offset - 1.f && t2 < -offset - 1.f)
+    {
+        RecursiveHullCheck(work, node.children[1], p1f, p2f, p1, p2);
+        return;
+    }
+
+    // The segment crosses the plane, the side of the start goes first.
+    // Both parts overlap a little around the plane.
+    int side;
+    float frac, frac2;
+
+    if (t1 < t2)
+    {
+        auto idist = 1.f / (t1 - t2);
+        side = 1;
+        frac2 = (t1 + offset + DistEpsilon) * idist;
+        frac = (t1 - offset + DistEpsilon) * idist;
+    }
+    else if (t1 > t2)
+    {
+        auto idist = 1.f / (t1 - t2);
+        side = 0;
+        frac2 = (t1 - offset - DistEpsilon) * idist;
+        frac = (t1 + offset + DistEpsilon) * idist;
+    }
+    else
+    {
+        side = 0;
+        frac = 1.f;
+        frac2 = 0.f;
+    }
+
+    frac = clamp(frac, 0.f, 1.f);
+    frac2 = clamp(frac2, 0.f, 1.f);
+
+    auto midf = p1f + (p2f - p1f) * frac;
+    auto mid = p1 + (p2 - p1) * frac;
+    RecursiveHullCheck(work, node.children[side], p1f, midf, p1, mid);
+
+    midf = p1f + (p2f - p1f) * frac2;
+    mid = p1 + (p2 - p1) * frac2;
+    RecursiveHullCheck(work, node.children[side ^ 1], midf, p2f, mid, p2);
+}
+
+void BSP::TraceToLeaf(TraceWork &work, int32_t num) const
+{
+    const auto &leaf = dleafs[num];
+
+    if (!(leaf.contents & work.mask))
+    {
+        return;
+    }
+
+    // Brushes spanning several leafs are clipped once per leaf, marking
+    // them would need state shared between the traces of a batch
+    for (int i = 0; i < leaf.numleafbrushes; i++)
+    {
+        const auto &brush = dbrushes[dleafbrushes[leaf.firstleafbrush + i]];
+
+        if (!(brush.contents & work.mask))
+        {
+            continue;
+        }
+
+        ClipBoxToBrush(work, brush);
+
+        if (work.result.allSolid)
+        {
+            return;
+        }
+    }
+}
+
+void BSP::ClipBoxToBrush(TraceWork &work, const dbrush_t &brush) const
+{
+    auto enterFrac = -1.f;
+    auto leaveFrac = 1.f;
+    const dplane_t *clipPlane = nullptr;
+
+    auto getOut = false;
+    auto startOut = false;
+
+    for (int i = 0; i < brush.numsides; i++)
+    {
+        const auto &side = dbrushsides[brush.firstside + i];
+
+        // Bevels only keep boxes from catching on sharp edges
+        if (work.isPoint && side.bevel)
+        {
+            continue;
+        }
+
+        const auto &plane = dplanes[side.planenum];
+
+        // The plane pushed out by the box
+        auto dist = plane.dist + dot(abs(plane.normal), work.extents);
+        auto d1 = dot(work.start, plane.normal) - dist;
+        auto d2 = dot(work.end, plane.normal) - dist;
+
+        if (d2 > 0.f)
+        {
+            getOut = true;
+        }
+
+        if (d1 > 0.f)
+        {
+            startOut = true;
+        }
+
+        // Entirely in front of this side, so outside the brush
+        if (d1 > 0.f && (d2 >= DistEpsilon || d2 >= d1))
+        {
+            return;
+        }
+
+        // Entirely behind, this side does not clip
+        if (d1 <= 0.f && d2 <= 0.f)
+        {
+            continue;
+        }
+
+        if (d1 > d2)
+        {
+            // Entering the brush
+            auto f = std::max((d1 - DistEpsilon) / (d1 - d2), 0.f);
+
+            if (f > enterFrac)
+            {
+                enterFrac = f;
+                clipPlane = &plane;
+            }
+        }
+        else
+        {
+            // Leaving the brush
+            auto f = std::min((d1 + DistEpsilon) / (d1 - d2), 1.f);
+
+            if (f < leaveFrac)
+            {
+                leaveFrac = f;
+            }
+        }
+    }
+
+    auto &result = work.result;
+
+    if (!startOut)
+    {
+        result.startSolid = true;
+
+        if (!getOut)
+        {
+            result.allSolid = true;
+            result.fraction = 0.f;
+            result.contents = brush.contents;
+        }
+
+        return;
+    }
+
+    if (enterFrac < leaveFrac && enterFrac > -1.f && enterFrac < result.fraction)
+    {
+        result.fraction = std::max(enterFrac, 0.f);
+        result.contents = brush.contents;
+        work.plane = clipPlane;
+    }
+}
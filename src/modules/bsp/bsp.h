@@ -1,6 +1,9 @@
 #ifndef BSP_H
 #define BSP_H
 
+#include "assetmanager.h"
+#include "lineararena.h"
+
 #include <glm/glm.hpp>
 
 #include <fstream>
@@ -111,6 +114,102 @@ struct dmodel_t
     int32_t firstface, numfaces;
 };
 
+// 0-2 are axial planes
+#define PLANE_X         0
+#define PLANE_Y         1
+#define PLANE_Z         2
+
+struct dplane_t
+{
+    glm::vec3 normal;
+    float dist;
+    int32_t type;
+};
+
+struct dnode_t
+{
+    int32_t planenum;
+    int32_t children[2];  // negative numbers are -(leafs+1), not nodes
+    int16_t mins[3], maxs[3];
+    uint16_t firstface, numfaces;
+    int16_t area;
+    int16_t paddding;
+};
+
+#define CONTENTS_EMPTY          0
+#define CONTENTS_SOLID          0x1
+#define CONTENTS_WINDOW         0x2
+#define CONTENTS_AUX            0x4
+#define CONTENTS_GRATE          0x8
+#define CONTENTS_SLIME          0x10
+#define CONTENTS_WATER          0x20
+#define CONTENTS_BLOCKLOS       0x40
+#define CONTENTS_OPAQUE         0x80
+#define CONTENTS_MOVEABLE       0x4000
+#define CONTENTS_PLAYERCLIP     0x10000
+#define CONTENTS_MONSTERCLIP    0x20000
+#define CONTENTS_MONSTER        0x2000000
+
+#define MASK_ALL                (0xFFFFFFFF)
+#define MASK_SOLID              (CONTENTS_SOLID|CONTENTS_MOVEABLE|CONTENTS_WINDOW|CONTENTS_MONSTER|CONTENTS_GRATE)
+#define MASK_PLAYERSOLID        (MASK_SOLID|CONTENTS_PLAYERCLIP)
+#define MASK_OPAQUE             (CONTENTS_SOLID|CONTENTS_MOVEABLE|CONTENTS_OPAQUE)
+#define MASK_SHOT               (CONTENTS_SOLID|CONTENTS_MOVEABLE|CONTENTS_MONSTER|CONTENTS_WINDOW)
+
+struct ColorRGBExp32
+{
+    uint8_t r, g, b;
+    int8_t exponent;
+};
+
+struct CompressedLightCube
+{
+    ColorRGBExp32 m_Color[6];
+};
+
+// Version 0 of the leaf lump, from maps that store the ambient lighting
+// in the leafs themselves
+struct dleaf_version_0_t
+{
+    int32_t contents;
+    int16_t cluster;
+    int16_t area : 9;
+    int16_t flags : 7;
+    int16_t mins[3], maxs[3];
+    uint16_t firstleafface, numleaffaces;
+    uint16_t firstleafbrush, numleafbrushes;
+    int16_t leafWaterDataID;
+    CompressedLightCube m_AmbientLighting;
+};
+
+struct dleaf_t
+{
+    int32_t contents;
+    int16_t cluster;
+    int16_t area : 9;
+    int16_t flags : 7;
+    int16_t mins[3], maxs[3];
+    uint16_t firstleafface, numleaffaces;
+    uint16_t firstleafbrush, numleafbrushes;
+    int16_t leafWaterDataID;
+};
+
+struct dbrush_t
+{
+    int32_t firstside;
+    int32_t numsides;
+    int32_t contents;
+};
+
+struct dbrushside_t
+{
+    uint16_t planenum;
+    int16_t texinfo;
+    int16_t dispinfo;
+    uint8_t bevel;
+    uint8_t thin;
+};
+
 #define SURF_LIGHT      0x0001
 #define SURF_SKY2D      0x0002
 #define SURF_SKY        0x0004
@@ -224,27 +323,53 @@ struct dface_t
     uint32_t smoothingGroups;
 };
 
-struct ColorRGBExp32
-{
-    uint8_t r, g, b;
-    int8_t exponent;
-};
-
 struct Vertex;
 struct Surface
 {
     int index;
-    std::vector<uint32_t> indices;
-    std::vector<Vertex> vertexes;
+    LinearVector<uint32_t> indices;
+    LinearVector<Vertex> vertexes;
+
+    explicit Surface(int, LinearArena &);
+};
+
+// Result of a trace, in world space like its input
+struct TraceResult
+{
+    float fraction;  // 1 when nothing was hit
+    glm::vec3 end;
+    glm::vec3 normal;  // of the plane hit
+    float distance;
+    int32_t contents;  // of the brush hit
+    bool startSolid;
+    bool allSolid;
+};
+
+struct TraceRequest
+{
+    glm::vec3 start, end;
+    glm::vec3 mins, maxs;  // zero for a line trace
+    int32_t mask;
 };
 
 class GameObject;
 class Texture;
+struct TraceWork;
 class BSP
 {
 public:
     void LoadBSPFile(std::string, bool);
 
+    // Traces through the brushes of the world whose contents match the
+    // mask, optionally sweeping a box given relative to the start point
+    TraceResult TraceLine(const glm::vec3 &, const glm::vec3 &, int32_t = MASK_SOLID) const;
+    TraceResult TraceBox(const glm::vec3 &, const glm::vec3 &, const glm::vec3 &, const glm::vec3 &, int32_t = MASK_SOLID) const;
+    // Runs the traces on the thread pool
+    void TraceBatch(const std::vector<TraceRequest> &, std::vector<TraceResult> &) const;
+
+    // Allocations of the temporaries built while loading
+    LinearArenaStats GetLoadStats() const;
+
 private:
     std::ifstream pFile;
 
@@ -263,18 +388,37 @@ private:
     std::vector<char> g_TexDataStringData;
     std::vector<int32_t> g_TexDataStringTable;
 
+    // Kept after loading for traces
+    std::vector<dplane_t> dplanes;
+    std::vector<dnode_t> dnodes;
+    std::vector<dleaf_t> dleafs;
+    std::vector<uint16_t> dleafbrushes;
+    std::vector<dbrush_t> dbrushes;
+    std::vector<dbrushside_t> dbrushsides;
+    int32_t worldHeadnode;
+
     GameObject *root;
+    // Temporaries of LoadBSPFile, released all at once when it returns
+    LinearArena arena;
 
     void ParseEntities();
     Surface BuildFace(int);
     Surface BuildDisplacement(int);
     GameObject *BuildModel(int);
-    Texture *PackLightmaps(std::vector<Surface> &);
+    glm::ivec3 GetFaceCluster(int);
+    glm::uvec2 GetLightmapSize(int) const;
+    std::vector<AssetHandle<Texture>> PackLightmaps(LinearVector<Surface> &, LinearVector<uint32_t> &);
+
+    void RecursiveHullCheck(TraceWork &, int32_t, float, float, const glm::vec3 &, const glm::vec3 &) const;
+    void TraceToLeaf(TraceWork &, int32_t) const;
+    void ClipBoxToBrush(TraceWork &, const dbrush_t &) const;
 
     template<typename T>
     void CopyLump(int, std::vector<T> &);
 
+    static void WrapTextureCoords(Surface &);
     static glm::vec3 FlipVector(const glm::vec3 &);
+    static glm::vec3 UnflipVector(const glm::vec3 &);
 };
 
 #endif // BSP_H
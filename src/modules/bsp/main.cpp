@@ -2,20 +2,30 @@
 #include "bsp.h"
 
 #include <iostream>
+#include <string>
 using std::cerr;
 using std::endl;
 using std::stoi;
+using std::string;
 
 int main(int argc, char *argv[])
 {
     if (argc < 2)
     {
-        cerr << "Usage: " << argv[0] << " <path> <hdr>" << endl;
+        cerr << "Usage: " << argv[0] << " <path> <hdr> [--stats]" << endl;
         return EXIT_FAILURE;
     }
 
     Application a("BSP Viewer");
     BSP bsp;
     bsp.LoadBSPFile(argv[1], stoi(argv[2]) != 0);
+
+    if (argc > 3 && string(argv[3]) == "--stats")
+    {
+        auto stats = bsp.GetLoadStats();
+        cerr << stats.allocations << " temporary allocations from "
+             << stats.blocks << " heap blocks while loading" << endl;
+    }
+
     return a.exec();
 }
@@ -0,0 +1,31 @@
+#include "occluder.h"
+#include "registry.h"
+
+using glm::vec3;
+
+using std::vector;
+
+Occluder::Occluder(const vector<vec3> &vertexes)
+    : vertexes(vertexes)
+{
+}
+
+Occluder::Occluder(const vec3 *vertexes, size_t count)
+    : vertexes(vertexes, vertexes + count)
+{
+}
+
+const vector<vec3> &Occluder::GetVertexes() const
+{
+    return vertexes;
+}
+
+void Occluder::Attach(uint32_t entity)
+{
+    Registry::GetPool<const Occluder *>().Insert(entity, this);
+}
+
+void Occluder::Detach(uint32_t entity)
+{
+    Registry::GetPool<const Occluder *>().Remove(entity);
+}
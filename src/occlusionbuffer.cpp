@@ -0,0 +1,307 @@
+#include "occlusionbuffer.h"
+#include "frameallocator.h"
+#include "threadpool.h"
+
+using glm::mat4;
+using glm::vec3;
+using glm::vec4;
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+using std::max;
+using std::min;
+using std::numeric_limits;
+using std::upper_bound;
+using std::vector;
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+constexpr uint32_t BandHeight = 8;
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+    : viewProjection(1.f)
+{
+    // Rows are processed four pixels at a time
+    width = (width + 3) & ~3u;
+
+    while (true)
+    {
+        levels.push_back({ width, height, vector<float>(width * height, numeric_limits<float>::max()) });
+
+        if (width == 1 && height == 1)
+        {
+            break;
+        }
+
+        width = max(1u, (width + 1) / 2);
+        height = max(1u, (height + 1) / 2);
+    }
+}
+
+void OcclusionBuffer::AddOccluder(const mat4 &model, const vector<vec3> &vertexes)
+{
+    occluders.push_back({ model, &vertexes });
+}
+
+void OcclusionBuffer::Rasterize(const mat4 &viewProjection)
+{
+    this->viewProjection = viewProjection;
+
+    LinearVector<size_t> offsets(FrameAllocator::GetAllocator<size_t>());
+    offsets.reserve(occluders.size() + 1);
+    offsets.push_back(0);
+
+    for (const auto &occluder : occluders)
+    {
+        offsets.push_back(offsets.back() + occluder.vertexes->size() / 3);
+    }
+
+    triangles.resize(offsets.back());
+
+    ThreadPool::ParallelFor(triangles.size(), [&](size_t begin, size_t end)
+    {
+        size_t o = upper_bound(offsets.begin(), offsets.end(), begin) - offsets.begin() - 1;
+        auto mvp = viewProjection * occluders[o].model;
+
+        for (auto i = begin; i < end; i++)
+        {
+            if (i >= offsets[o + 1])
+            {
+                while (i >= offsets[o + 1])
+                {
+                    o++;
+                }
+
+                mvp = viewProjection * occluders[o].model;
+            }
+
+            SetupTriangle(mvp, occluders[o].vertexes->data() + (i - offsets[o]) * 3, triangles[i]);
+        }
+    });
+
+    auto bands = (levels[0].height + BandHeight - 1) / BandHeight;
+
+    ThreadPool::ParallelFor(bands, [&](size_t begin, size_t end)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            RasterizeBand(i * BandHeight, min<uint32_t>((i + 1) * BandHeight, levels[0].height));
+        }
+    });
+
+    BuildPyramid();
+    occluders.clear();
+}
+
+bool OcclusionBuffer::IsVisible(const vec3 &mins, const vec3 &maxs) const
+{
+    const auto &base = levels[0];
+    auto minX = numeric_limits<float>::max();
+    auto minY = numeric_limits<float>::max();
+    auto maxX = -numeric_limits<float>::max();
+    auto maxY = -numeric_limits<float>::max();
+    auto minW = numeric_limits<float>::max();
+
+    for (int i = 0; i < 8; i++)
+    {
+        auto clip = viewProjection * vec4(i & 1 ? maxs.x : mins.x,
+                                          i & 2 ? maxs.y : mins.y,
+                                          i & 4 ? maxs.z : mins.z,
+                                          1.f);
+
+        // Crossing the near plane, the projected rectangle is meaningless
+        if (clip.z < -clip.w)
+        {
+            return true;
+        }
+
+        auto x = (clip.x / clip.w * .5f + .5f) * base.width;
+        auto y = (clip.y / clip.w * .5f + .5f) * base.height;
+        minX = min(minX, x);
+        minY = min(minY, y);
+        maxX = max(maxX, x);
+        maxY = max(maxY, y);
+        minW = min(minW, clip.w);
+    }
+
+    if (maxX < 0.f || maxY < 0.f || minX >= base.width || minY >= base.height)
+    {
+        return true;
+    }
+
+    auto x0 = static_cast<uint32_t>(max(minX, 0.f));
+    auto y0 = static_cast<uint32_t>(max(minY, 0.f));
+    auto x1 = static_cast<uint32_t>(min(maxX, base.width - 1.f));
+    auto y1 = static_cast<uint32_t>(min(maxY, base.height - 1.f));
+
+    // Pick the level where the rectangle spans at most 2x2 texels
+    size_t level = 0;
+
+    while (level + 1 < levels.size() &&
+            ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+    {
+        level++;
+    }
+
+    const auto &hiz = levels[level];
+    auto maxDepth = 0.f;
+
+    for (auto y = y0 >> level; y <= (y1 >> level); y++)
+    {
+        for (auto x = x0 >> level; x <= (x1 >> level); x++)
+        {
+            maxDepth = max(maxDepth, hiz.depth[y * hiz.width + x]);
+        }
+    }
+
+    return minW <= maxDepth;
+}
+
+void OcclusionBuffer::SetupTriangle(const mat4 &mvp, const vec3 *vertexes, Triangle &triangle) const
+{
+    const auto &base = levels[0];
+    float x[3], y[3];
+
+    triangle.minX = 0;
+    triangle.maxX = -1;
+    triangle.depth = 0.f;
+
+    for (int i = 0; i < 3; i++)
+    {
+        auto clip = mvp * vec4(vertexes[i], 1.f);
+
+        // Dropping an occluder is always conservative, clipping is not worth it
+        if (clip.z < -clip.w)
+        {
+            return;
+        }
+
+        x[i] = (clip.x / clip.w * .5f + .5f) * base.width;
+        y[i] = (clip.y / clip.w * .5f + .5f) * base.height;
+        triangle.depth = max(triangle.depth, clip.w);
+    }
+
+    auto area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+    if (std::fabs(area) < 1.f)
+    {
+        return;
+    }
+
+    if (area < 0.f)
+    {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        auto j = (i + 1) % 3;
+        triangle.a[i] = y[i] - y[j];
+        triangle.b[i] = x[j] - x[i];
+        triangle.c[i] = x[i] * y[j] - y[i] * x[j]
+                        - (std::fabs(triangle.a[i]) + std::fabs(triangle.b[i])) * .5f;
+    }
+
+    triangle.minX = max<int32_t>(std::floor(min({ x[0], x[1], x[2] })), 0);
+    triangle.minY = max<int32_t>(std::floor(min({ y[0], y[1], y[2] })), 0);
+    triangle.maxX = min<int32_t>(std::ceil(max({ x[0], x[1], x[2] })), base.width - 1);
+    triangle.maxY = min<int32_t>(std::ceil(max({ y[0], y[1], y[2] })), base.height - 1);
+}
+
+void OcclusionBuffer::RasterizeBand(uint32_t y0, uint32_t y1)
+{
+    auto &base = levels[0];
+    std::fill(base.depth.begin() + y0 * base.width,
+              base.depth.begin() + y1 * base.width,
+              numeric_limits<float>::max());
+
+    for (const auto &triangle : triangles)
+    {
+        if (triangle.maxX < triangle.minX ||
+                triangle.maxY < static_cast<int32_t>(y0) ||
+                triangle.minY >= static_cast<int32_t>(y1))
+        {
+            continue;
+        }
+
+        auto rowBegin = max<int32_t>(triangle.minY, y0);
+        auto rowEnd = min<int32_t>(triangle.maxY + 1, y1);
+        auto columnBegin = triangle.minX & ~3;
+
+        for (auto y = rowBegin; y < rowEnd; y++)
+        {
+            auto row = base.depth.data() + y * base.width;
+            auto py = y + .5f;
+
+#ifdef __SSE2__
+            auto depth = _mm_set1_ps(triangle.depth);
+            auto zero = _mm_setzero_ps();
+            __m128 a[3], e[3];
+
+            for (int i = 0; i < 3; i++)
+            {
+                a[i] = _mm_set1_ps(triangle.a[i]);
+                e[i] = _mm_set1_ps(triangle.b[i] * py + triangle.c[i]);
+            }
+
+            for (auto x = columnBegin; x <= triangle.maxX; x += 4)
+            {
+                auto px = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), _mm_set_ps(3.5f, 2.5f, 1.5f, .5f));
+                auto mask = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[0], px), e[0]), zero);
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[1], px), e[1]), zero));
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a[2], px), e[2]), zero));
+
+                auto current = _mm_loadu_ps(row + x);
+                auto nearer = _mm_min_ps(current, depth);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(mask, nearer), _mm_andnot_ps(mask, current)));
+            }
+#else
+            for (auto x = columnBegin; x <= triangle.maxX; x++)
+            {
+                auto px = x + .5f;
+                auto inside = true;
+
+                for (int i = 0; i < 3; i++)
+                {
+                    inside = inside && triangle.a[i] * px + triangle.b[i] * py + triangle.c[i] >= 0.f;
+                }
+
+                if (inside)
+                {
+                    row[x] = min(row[x], triangle.depth);
+                }
+            }
+#endif
+        }
+    }
+}
+
+void OcclusionBuffer::BuildPyramid()
+{
+    for (size_t i = 1; i < levels.size(); i++)
+    {
+        const auto &src = levels[i - 1];
+        auto &dst = levels[i];
+
+        for (uint32_t y = 0; y < dst.height; y++)
+        {
+            auto sy0 = min(y * 2, src.height - 1);
+            auto sy1 = min(y * 2 + 1, src.height - 1);
+
+            for (uint32_t x = 0; x < dst.width; x++)
+            {
+                auto sx0 = min(x * 2, src.width - 1);
+                auto sx1 = min(x * 2 + 1, src.width - 1);
+
+                dst.depth[y * dst.width + x] = max(max(src.depth[sy0 * src.width + sx0],
+                                                       src.depth[sy0 * src.width + sx1]),
+                                                   max(src.depth[sy1 * src.width + sx0],
+                                                       src.depth[sy1 * src.width + sx1]));
+            }
+        }
+    }
+}
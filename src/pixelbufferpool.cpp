@@ -0,0 +1,137 @@
+#include "pixelbufferpool.h"
+
+#include <glad.h>
+
+#include <algorithm>
+#include <stdexcept>
+using std::max;
+using std::runtime_error;
+using std::vector;
+
+constexpr size_t MaxBuffers = 4;
+constexpr size_t MinimumCapacity = 1 << 20;
+constexpr uint64_t WaitTimeout = 1000000000;
+
+vector<PixelBufferPool::Buffer> PixelBufferPool::buffers;
+size_t PixelBufferPool::current;
+uint64_t PixelBufferPool::issued;
+
+uint8_t *PixelBufferPool::Acquire(size_t size)
+{
+    // An idle buffer that is large enough, or else any idle one
+    current = buffers.size();
+
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        if (!IsIdle(buffers[i]))
+        {
+            continue;
+        }
+
+        if (current == buffers.size() || (buffers[i].capacity >= size && buffers[current].capacity < size))
+        {
+            current = i;
+        }
+    }
+
+    if (current == buffers.size())
+    {
+        if (buffers.size() < MaxBuffers)
+        {
+            Buffer buffer = {};
+            glGenBuffers(1, &buffer.name);
+            buffers.push_back(buffer);
+        }
+        else
+        {
+            // Every buffer is in flight, wait for the one fenced first
+            current = 0;
+
+            for (size_t i = 1; i < buffers.size(); i++)
+            {
+                if (buffers[i].issue < buffers[current].issue)
+                {
+                    current = i;
+                }
+            }
+
+            while (glClientWaitSync(buffers[current].fence, GL_SYNC_FLUSH_COMMANDS_BIT, WaitTimeout) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+
+            glDeleteSync(buffers[current].fence);
+            buffers[current].fence = nullptr;
+        }
+    }
+
+    auto &buffer = buffers[current];
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer.name);
+
+    if (buffer.capacity < size)
+    {
+        buffer.capacity = max(size, MinimumCapacity);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer.capacity, nullptr, GL_STREAM_DRAW);
+    }
+
+    // The fence has passed, so there is nothing to synchronize with
+    auto data = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+    if (!data)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        throw runtime_error("Failed to map pixel buffer");
+    }
+
+    return static_cast<uint8_t *>(data);
+}
+
+void PixelBufferPool::Unmap()
+{
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        throw runtime_error("Pixel buffer contents were lost");
+    }
+}
+
+void PixelBufferPool::Release()
+{
+    buffers[current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffers[current].issue = issued++;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void PixelBufferPool::Clear()
+{
+    for (auto &buffer : buffers)
+    {
+        if (buffer.fence)
+        {
+            glDeleteSync(buffer.fence);
+        }
+
+        glDeleteBuffers(1, &buffer.name);
+    }
+
+    buffers.clear();
+}
+
+bool PixelBufferPool::IsIdle(Buffer &buffer)
+{
+    if (!buffer.fence)
+    {
+        return true;
+    }
+
+    auto status = glClientWaitSync(buffer.fence, 0, 0);
+
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+    {
+        return false;
+    }
+
+    glDeleteSync(buffer.fence);
+    buffer.fence = nullptr;
+    return true;
+}
@@ -0,0 +1,231 @@
+#include "programcache.h"
+
+#include <glad.h>
+
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+using std::hex;
+using std::ifstream;
+using std::ofstream;
+using std::ostringstream;
+using std::runtime_error;
+using std::setfill;
+using std::setw;
+using std::streamoff;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+struct BinaryHeader
+{
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+unordered_map<uint64_t, uint32_t> ProgramCache::programs;
+string ProgramCache::directory = ".";
+
+uint32_t ProgramCache::GetProgram(const string &vertexSource, const string &fragmentSource)
+{
+    auto key = Hash(vertexSource, fragmentSource);
+    auto it = programs.find(key);
+
+    if (it != programs.end())
+    {
+        return it->second;
+    }
+
+    auto program = Load(key);
+
+    if (!program)
+    {
+        program = Compile(vertexSource, fragmentSource);
+        Store(key, program);
+    }
+
+    programs.insert({key, program});
+    return program;
+}
+
+void ProgramCache::SetDirectory(const string &path)
+{
+    directory = path;
+}
+
+void ProgramCache::Clear()
+{
+    for (const auto &program : programs)
+    {
+        glDeleteProgram(program.second);
+    }
+
+    programs.clear();
+}
+
+uint64_t ProgramCache::Hash(const string &vertexSource, const string &fragmentSource)
+{
+    // FNV-1a over the sources and everything identifying the driver
+    uint64_t hash = 14695981039346656037ull;
+
+    for (const auto &s :
+            {
+                vertexSource,
+                fragmentSource,
+                string(reinterpret_cast<const char *>(glGetString(GL_VENDOR))),
+                string(reinterpret_cast<const char *>(glGetString(GL_RENDERER))),
+                string(reinterpret_cast<const char *>(glGetString(GL_VERSION)))
+            })
+    {
+        for (auto c : s)
+        {
+            hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+        }
+
+        // Terminator, so that text moving between strings changes the hash
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+string ProgramCache::GetPath(uint64_t key)
+{
+    ostringstream path;
+    path << directory << "/" << hex << setw(16) << setfill('0') << key << ".bin";
+    return path.str();
+}
+
+uint32_t ProgramCache::Load(uint64_t key)
+{
+    if (!GLAD_GL_ARB_get_program_binary)
+    {
+        return 0;
+    }
+
+    ifstream file(GetPath(key), ifstream::in | ifstream::binary);
+    BinaryHeader header;
+
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.key != key)
+    {
+        return 0;
+    }
+
+    // A truncated or corrupt file must not size the allocation
+    auto start = file.tellg();
+    file.seekg(0, ifstream::end);
+    auto remaining = file.tellg() - start;
+    file.seekg(start);
+
+    if (!file || remaining != static_cast<streamoff>(header.length))
+    {
+        return 0;
+    }
+
+    vector<char> binary(header.length);
+
+    if (!file.read(binary.data(), binary.size()))
+    {
+        return 0;
+    }
+
+    int32_t success;
+    auto program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), header.length);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    // Rejected after a driver update or for any other reason
+    if (!success)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void ProgramCache::Store(uint64_t key, uint32_t program)
+{
+    if (!GLAD_GL_ARB_get_program_binary)
+    {
+        return;
+    }
+
+    int32_t length;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+    {
+        return;
+    }
+
+    vector<char> binary(length);
+    BinaryHeader header;
+    glGetProgramBinary(program, length, &length, &header.format, binary.data());
+    header.key = key;
+    header.length = length;
+
+    ofstream file(GetPath(key), ofstream::out | ofstream::binary | ofstream::trunc);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(binary.data(), header.length);
+}
+
+uint32_t ProgramCache::Compile(const string &vertexSource, const string &fragmentSource)
+{
+    int32_t success, logLength;
+    vector<char> log;
+    auto vShaderCode = vertexSource.c_str();
+    auto fShaderCode = fragmentSource.c_str();
+    auto vShader = glCreateShader(GL_VERTEX_SHADER);
+    auto fShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(vShader, 1, &vShaderCode, nullptr);
+    glShaderSource(fShader, 1, &fShaderCode, nullptr);
+    glCompileShader(vShader);
+    glGetShaderiv(vShader, GL_COMPILE_STATUS, &success);
+
+    if (!success)
+    {
+        glGetShaderiv(vShader, GL_INFO_LOG_LENGTH, &logLength);
+        log.resize(logLength);
+        glGetShaderInfoLog(vShader, logLength, nullptr, log.data());
+        throw runtime_error(string("Failed to compile vertex shader:\n") + log.data());
+    }
+
+    glCompileShader(fShader);
+    glGetShaderiv(fShader, GL_COMPILE_STATUS, &success);
+
+    if (!success)
+    {
+        glGetShaderiv(fShader, GL_INFO_LOG_LENGTH, &logLength);
+        log.resize(logLength);
+        glGetShaderInfoLog(fShader, logLength, nullptr, log.data());
+        throw runtime_error(string("Failed to compile fragment shader:\n") + log.data());
+    }
+
+    auto program = glCreateProgram();
+    glAttachShader(program, vShader);
+    glAttachShader(program, fShader);
+
+    if (GLAD_GL_ARB_get_program_binary)
+    {
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+
+    if (!success)
+    {
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+        log.resize(logLength);
+        glGetProgramInfoLog(program, logLength, nullptr, log.data());
+        throw runtime_error(string("Failed to link shader program:\n") + log.data());
+    }
+
+    glDeleteShader(vShader);
+    glDeleteShader(fShader);
+    return program;
+}
@@ -0,0 +1,16 @@
+#include "registry.h"
+
+using std::vector;
+
+vector<ComponentPoolBase *> Registry::pools;
+
+void Registry::Remove(uint32_t entity)
+{
+    for (auto pool : pools)
+    {
+        if (pool->Contains(entity))
+        {
+            pool->Remove(entity);
+        }
+    }
+}
@@ -1,12 +1,33 @@
 R""(
 #version 330 core
+#ifdef BASE_TEXTURE
 in vec2 frag_uv1;
-in vec2 frag_uv2;
-out vec4 color;
 uniform sampler2D _MainTex;
+#endif
+#ifdef LIGHTMAP
+in vec2 frag_uv2;
 uniform sampler2D _LightmapTex;
+#endif
+out vec4 color;
 void main()
 {
-    color = texture(_MainTex, frag_uv1) + texture(_LightmapTex, frag_uv2);
+    color = vec4(0.f, 0.f, 0.f, 1.f);
+#ifdef BASE_TEXTURE
+    color = texture(_MainTex, frag_uv1);
+#endif
+#ifdef ALPHA_TEST
+    if (color.a < .5f)
+    {
+        discard;
+    }
+#endif
+#ifdef LIGHTMAP
+    vec4 light = texture(_LightmapTex, frag_uv2);
+#ifdef HDR_DECODE
+    // RGBE, with the biased exponent stored in alpha
+    light.rgb *= exp2(light.a * 255.f - 128.f);
+#endif
+    color.rgb += light.rgb;
+#endif
 }
 )""
@@ -3,15 +3,23 @@ R""(
 layout (location = 0) in vec3 vs_position;
 layout (location = 1) in vec2 vs_uv1;
 layout (location = 2) in vec2 vs_uv2;
+#ifdef BASE_TEXTURE
 out vec2 frag_uv1;
+#endif
+#ifdef LIGHTMAP
 out vec2 frag_uv2;
+#endif
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 void main()
 {
     gl_Position = projection * view * model * vec4(vs_position, 1.f);
+#ifdef BASE_TEXTURE
     frag_uv1 = vs_uv1;
+#endif
+#ifdef LIGHTMAP
     frag_uv2 = vs_uv2;
+#endif
 }
 )""
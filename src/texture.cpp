@@ -1,72 +1,178 @@
 #include "texture.h"
+#include "lineararena.h"
+#include "pixelbufferpool.h"
+#include "texelview.h"
+#include "threadpool.h"
 
 #include <glad.h>
+#include <glm/gtc/constants.hpp>
+using glm::pi;
 
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <cstring>
+#include <numeric>
 #include <stdexcept>
+using std::array;
+using std::fill;
+using std::iota;
 using std::logic_error;
+using std::max;
+using std::min;
+using std::stable_sort;
 using std::vector;
 
-Texture::Texture(uint32_t width, uint32_t height, TextureFormat textureFormat)
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static array<float, 6> GetKaiserWeights()
 {
-    if (width < 0 || height < 0)
+    // Zeroth order modified Bessel function of the first kind
+    auto bessel = [](float x)
     {
-        throw logic_error("Width and/or height values cannot be negative");
-    }
+        auto sum = 1.f, term = 1.f;
 
-    switch (textureFormat)
+        for (int k = 1; k < 16; k++)
+        {
+            term *= x * x / (4.f * k * k);
+            sum += term;
+        }
+
+        return sum;
+    };
+
+    const auto alpha = 4.f;
+    const auto radius = 3.f;
+
+    array<float, 6> weights;
+    auto total = 0.f;
+
+    for (int i = 0; i < 6; i++)
     {
-    case TextureFormat::DXT1:
+        // Source texel centers lie half a texel either side of the
+        // destination center
+        auto d = i - 2.5f;
+        auto x = pi<float>() * d / 2.f;
+        auto ratio = d / radius;
+
+        weights[i] = std::sin(x) / x * bessel(alpha * std::sqrt(1.f - ratio * ratio)) / bessel(alpha);
+        total += weights[i];
+    }
+
+    for (auto &weight : weights)
     {
-        internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
-        bitsPerPixel = 4;
-        compressed = true;
+        weight /= total;
     }
-    break;
 
-    case TextureFormat::DXT1_ONEBITALPHA:
+    return weights;
+}
+
+struct LoadKernel
+{
+    const uint8_t *texel;
+    Color color;
+
+    template<TextureFormat Format>
+    void Run()
     {
-        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-        bitsPerPixel = 4;
-        compressed = true;
+        color = TexelFormat<Format>::Decode(texel);
     }
-    break;
+};
 
-    case TextureFormat::DXT3:
+struct StoreKernel
+{
+    uint8_t *texel;
+    const Color &color;
+
+    template<TextureFormat Format>
+    void Run()
     {
-        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
-        bitsPerPixel = 8;
-        compressed = true;
+        TexelFormat<Format>::Encode(texel, color);
     }
-    break;
+};
 
-    case TextureFormat::DXT5:
+struct ConvertKernel
+{
+    const uint8_t *source;
+    uint8_t *dest;
+    size_t count;
+
+    template<TextureFormat Source, TextureFormat Dest>
+    void Run()
     {
-        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-        bitsPerPixel = 8;
-        compressed = true;
+        ConvertTexels<Source, Dest>(source, dest, count);
     }
-    break;
+};
 
-    case TextureFormat::RGB24:
+struct BlitKernel
+{
+    const Texture &source;
+    const Rect &rect;
+    Texture &dest;
+    const uvec2 &position;
+
+    template<TextureFormat Source, TextureFormat Dest>
+    void Run()
     {
-        internalformat = GL_RGB8;
-        format = GL_RGB;
-        bitsPerPixel = 24;
-        compressed = false;
+        TexelView<Source, const uint8_t> from(source);
+        TexelView<Dest> to(dest);
+
+        // Within one texture, a destination below the source is copied
+        // from the bottom up so that no row is overwritten before it is read
+        auto upwards = &source == &dest && position.y > rect.position.y;
+
+        for (uint32_t i = 0; i < rect.size.y; i++)
+        {
+            auto y = upwards ? rect.size.y - 1 - i : i;
+
+            ConvertTexels<Source, Dest>(from.Row(rect.position.y + y) + rect.position.x * TexelFormat<Source>::Stride,
+                                        to.Row(position.y + y) + position.x * TexelFormat<Dest>::Stride,
+                                        rect.size.x);
+        }
     }
-    break;
+};
 
-    case TextureFormat::RGBA32:
+struct FillKernel
+{
+    Texture &texture;
+    const Rect &rect;
+    const Color &color;
+
+    template<TextureFormat Format>
+    void Run()
     {
-        internalformat = GL_RGBA8;
-        format = GL_RGBA;
-        bitsPerPixel = 32;
-        compressed = false;
+        TexelView<Format> view(texture);
+
+        auto rowSize = rect.size.x * TexelFormat<Format>::Stride;
+        auto first = view.Row(rect.position.y) + rect.position.x * TexelFormat<Format>::Stride;
+
+        // One texel, doubled until the first row is complete, then copied
+        // to the other rows
+        TexelFormat<Format>::Encode(first, color);
+
+        for (size_t filled = TexelFormat<Format>::Stride; filled < rowSize; filled *= 2)
+        {
+            memcpy(first + filled, first, min<size_t>(filled, rowSize - filled));
+        }
+
+        for (uint32_t y = 1; y < rect.size.y; y++)
+        {
+            memcpy(view.Row(rect.position.y + y) + rect.position.x * TexelFormat<Format>::Stride, first, rowSize);
+        }
     }
-    break;
+};
+
+Texture::Texture(uint32_t width, uint32_t height, TextureFormat textureFormat)
+    : storageLevels(0)
+{
+    if (width < 0 || height < 0)
+    {
+        throw logic_error("Width and/or height values cannot be negative");
     }
 
+    SetFormat(textureFormat);
     Allocate(width, height);
     glGenTextures(1, &name);
 }
@@ -78,37 +184,203 @@ Texture::~Texture()
 
 void Texture::Apply(bool updateMipmaps)
 {
-    glBindTexture(GL_TEXTURE_2D, name);
+    // Blocks cannot be filtered, compressed textures upload the levels
+    // they were given, or only level 0
+    if (updateMipmaps && mipmaps.empty() && !compressed)
+    {
+        GenerateMipmaps();
+    }
 
-    if (compressed)
+    auto levels = updateMipmaps ? GetMipmapCount() : 1;
+
+    if (levels != storageLevels || width != storageWidth || height != storageHeight || internalformat != storageFormat)
     {
-        glCompressedTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, buffer.size(), buffer.data());
+        AllocateStorage(levels);
     }
-    else
+
+    glBindTexture(GL_TEXTURE_2D, name);
+
+    // Every level is staged in one pixel buffer, the copies into the
+    // texture then run on the GPU without blocking this thread
+    size_t size = 0;
+
+    for (uint32_t level = 0; level < levels; level++)
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, internalformat, width, height, 0, format, GL_UNSIGNED_BYTE, buffer.data());
+        size += level ? mipmaps[level - 1].size() : buffer.size();
     }
 
-    if (updateMipmaps)
+    auto staging = PixelBufferPool::Acquire(size);
+    size_t offset = 0;
+
+    for (uint32_t level = 0; level < levels; level++)
     {
-        glGenerateMipmap(GL_TEXTURE_2D);
+        const auto &data = level ? mipmaps[level - 1] : buffer;
+        memcpy(staging + offset, data.data(), data.size());
+        offset += data.size();
     }
-    else
+
+    PixelBufferPool::Unmap();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    auto levelWidth = width;
+    auto levelHeight = height;
+    offset = 0;
+
+    for (uint32_t level = 0; level < levels; level++)
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        auto levelSize = GetLevelSize(levelWidth, levelHeight);
+        auto pointer = reinterpret_cast<const void *>(offset);
+
+        if (compressed)
+        {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, internalformat, levelSize, pointer);
+        }
+        else
+        {
+            glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, levelWidth, levelHeight, format, GL_UNSIGNED_BYTE, pointer);
+        }
+
+        offset += levelSize;
+        levelWidth = max(levelWidth / 2, 1u);
+        levelHeight = max(levelHeight / 2, 1u);
     }
 
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    PixelBufferPool::Release();
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+
     glBindTexture(GL_TEXTURE_2D, 0);
 }
 
-void Texture::LoadRawTextureData(const uintptr_t *data)
+void Texture::Compress(TextureFormat textureFormat, CompressionQuality quality)
 {
-    memcpy(buffer.data(), data, buffer.size());
+    if (compressed || bitsPerPixel != 32)
+    {
+        throw logic_error("Only RGBA32 textures can be compressed");
+    }
+
+    auto blockSize = BlockEncoder::GetBlockSize(textureFormat);
+    auto levelWidth = width;
+    auto levelHeight = height;
+
+    for (uint32_t level = 0; level < GetMipmapCount(); level++)
+    {
+        auto &data = level ? mipmaps[level - 1] : buffer;
+
+        vector<uint8_t> blocks((levelWidth + 3) / 4 * ((levelHeight + 3) / 4) * blockSize);
+        BlockEncoder::Encode(data.data(), levelWidth, levelHeight, textureFormat, quality, blocks.data());
+        data.swap(blocks);
+
+        levelWidth = max(levelWidth / 2, 1u);
+        levelHeight = max(levelHeight / 2, 1u);
+    }
+
+    SetFormat(textureFormat);
 }
 
-vector<Rect> Texture::PackTextures(const vector<Texture *> &textures)
+void Texture::Convert(TextureFormat textureFormat)
 {
-    return PackTextures(textures, width, height);
+    switch (textureFormat)
+    {
+    case TextureFormat::RGB24:
+    case TextureFormat::RGBA32:
+        break;
+
+    default:
+        return Compress(textureFormat);
+    }
+
+    if (compressed)
+    {
+        throw logic_error("Not supported for compressed textures");
+    }
+
+    auto sourceFormat = this->textureFormat;
+    SetFormat(textureFormat);
+
+    auto levelWidth = width;
+    auto levelHeight = height;
+
+    for (uint32_t level = 0; level < GetMipmapCount(); level++)
+    {
+        auto &data = level ? mipmaps[level - 1] : buffer;
+
+        vector<uint8_t> converted(GetLevelSize(levelWidth, levelHeight));
+        ConvertKernel kernel{data.data(), converted.data(), levelWidth * levelHeight};
+        DispatchTexelFormats(sourceFormat, textureFormat, kernel);
+        data.swap(converted);
+
+        levelWidth = max(levelWidth / 2, 1u);
+        levelHeight = max(levelHeight / 2, 1u);
+    }
+}
+
+void Texture::GenerateMipmaps(MipFilter filter)
+{
+    if (compressed)
+    {
+        throw logic_error("Not supported for compressed textures");
+    }
+
+    mipmaps.clear();
+
+    auto channels = bitsPerPixel / 8;
+    auto levelWidth = width;
+    auto levelHeight = height;
+
+    // Each level is filtered from the previous one, rows of a level are
+    // spread over the thread pool
+    while (levelWidth > 1 || levelHeight > 1)
+    {
+        auto nextWidth = max(levelWidth / 2, 1u);
+        auto nextHeight = max(levelHeight / 2, 1u);
+
+        mipmaps.emplace_back(GetLevelSize(nextWidth, nextHeight));
+
+        const auto &source = mipmaps.size() > 1 ? mipmaps[mipmaps.size() - 2] : buffer;
+
+        switch (filter)
+        {
+        case MipFilter::Box:
+            DownsampleBox(source.data(), levelWidth, levelHeight, channels, mipmaps.back().data());
+            break;
+
+        case MipFilter::Kaiser:
+            DownsampleKaiser(source.data(), levelWidth, levelHeight, channels, mipmaps.back().data());
+            break;
+        }
+
+        levelWidth = nextWidth;
+        levelHeight = nextHeight;
+    }
+}
+
+void Texture::LoadRawTextureData(const uintptr_t *data, uint32_t levels)
+{
+    auto bytes = reinterpret_cast<const uint8_t *>(data);
+    auto levelWidth = width;
+    auto levelHeight = height;
+
+    memcpy(buffer.data(), bytes, buffer.size());
+    bytes += buffer.size();
+    mipmaps.clear();
+
+    for (uint32_t level = 1; level < levels; level++)
+    {
+        if (levelWidth == 1 && levelHeight == 1)
+        {
+            throw logic_error("More levels than the mip chain has");
+        }
+
+        levelWidth = max(levelWidth / 2, 1u);
+        levelHeight = max(levelHeight / 2, 1u);
+
+        mipmaps.emplace_back(bytes, bytes + GetLevelSize(levelWidth, levelHeight));
+        bytes += mipmaps.back().size();
+    }
 }
 
 uintmax_t Texture::GetArea() const
@@ -126,6 +398,16 @@ uint32_t Texture::GetHeight() const
     return height;
 }
 
+uint32_t Texture::GetMipmapCount() const
+{
+    return mipmaps.size() + 1;
+}
+
+TextureFormat Texture::GetFormat() const
+{
+    return textureFormat;
+}
+
 Color Texture::GetPixel(uint32_t pixel) const
 {
     if (compressed)
@@ -138,149 +420,469 @@ Color Texture::GetPixel(uint32_t pixel) const
         throw logic_error("Out of the image");
     }
 
-    Color color(255);
-    auto offset = pixel * bitsPerPixel / 8;
+    LoadKernel kernel{buffer.data() + pixel * bitsPerPixel / 8, Color()};
+    DispatchTexelFormat(textureFormat, kernel);
+
+    return kernel.color;
+}
+
+Color Texture::GetPixel(uint32_t x, uint32_t y) const
+{
+    return GetPixel(y * width + x);
+}
 
-    if (bitsPerPixel >= 8)
+void Texture::SetPixel(uint32_t pixel, const Color &color)
+{
+    if (compressed)
     {
-        color.r = buffer[offset];
+        throw logic_error("Not supported for compressed textures");
     }
 
-    if (bitsPerPixel >= 16)
+    if (pixel >= GetArea())
     {
-        color.g = buffer[offset + 1];
+        throw logic_error("Out of the image");
     }
 
-    if (bitsPerPixel >= 24)
+    mipmaps.clear();
+
+    StoreKernel kernel{buffer.data() + pixel * bitsPerPixel / 8, color};
+    DispatchTexelFormat(textureFormat, kernel);
+}
+
+void Texture::SetPixel(uint32_t x, uint32_t y, const Color &color)
+{
+    return SetPixel(y * width + x, color);
+}
+
+uint8_t *Texture::Row(uint32_t y)
+{
+    mipmaps.clear();
+    return const_cast<uint8_t *>(static_cast<const Texture *>(this)->Row(y));
+}
+
+const uint8_t *Texture::Row(uint32_t y) const
+{
+    if (compressed)
     {
-        color.b = buffer[offset + 2];
+        throw logic_error("Not supported for compressed textures");
     }
 
-    if (bitsPerPixel >= 32)
+    if (y >= height)
     {
-        color.a = buffer[offset + 3];
+        throw logic_error("Out of the image");
     }
 
-    return color;
+    return buffer.data() + y * width * bitsPerPixel / 8;
 }
 
-Color Texture::GetPixel(uint32_t x, uint32_t y) const
+void Texture::Blit(const Texture &source, const Rect &sourceRect, const uvec2 &position)
 {
-    return GetPixel(y * width + x);
+    if (compressed || source.compressed)
+    {
+        throw logic_error("Not supported for compressed textures");
+    }
+
+    if (sourceRect.position.x + sourceRect.size.x > source.width ||
+            sourceRect.position.y + sourceRect.size.y > source.height ||
+            position.x + sourceRect.size.x > width ||
+            position.y + sourceRect.size.y > height)
+    {
+        throw logic_error("Out of the image");
+    }
+
+    BlitKernel kernel{source, sourceRect, *this, position};
+    DispatchTexelFormats(source.textureFormat, textureFormat, kernel);
 }
 
-void Texture::SetPixel(uint32_t pixel, const Color &color)
+void Texture::Fill(const Color &color)
+{
+    Fill(Rect{uvec2(0u), uvec2(width, height)}, color);
+}
+
+void Texture::Fill(const Rect &rect, const Color &color)
 {
     if (compressed)
     {
         throw logic_error("Not supported for compressed textures");
     }
 
-    if (pixel >= GetArea())
+    if (rect.position.x + rect.size.x > width || rect.position.y + rect.size.y > height)
     {
         throw logic_error("Out of the image");
     }
 
-    auto offset = pixel * bitsPerPixel / 8;
+    if (!rect.size.x || !rect.size.y)
+    {
+        return;
+    }
+
+    FillKernel kernel{*this, rect, color};
+    DispatchTexelFormat(textureFormat, kernel);
+}
 
-    if (bitsPerPixel >= 8)
+void Texture::Allocate(uint32_t newWidth, uint32_t newHeight)
+{
+    width = newWidth;
+    height = newHeight;
+    buffer.resize(GetLevelSize(width, height));
+    mipmaps.clear();
+}
+
+void Texture::AllocateStorage(uint32_t levels)
+{
+    // Immutable storage cannot be respecified, so a new name is needed
+    if (storageLevels)
     {
-        buffer[offset] = color.r;
+        glDeleteTextures(1, &name);
+        glGenTextures(1, &name);
     }
 
-    if (bitsPerPixel >= 16)
+    glBindTexture(GL_TEXTURE_2D, name);
+
+    if (GLAD_GL_ARB_texture_storage)
     {
-        buffer[offset + 1] = color.g;
+        glTexStorage2D(GL_TEXTURE_2D, levels, internalformat, width, height);
     }
+    else
+    {
+        auto levelWidth = width;
+        auto levelHeight = height;
 
-    if (bitsPerPixel >= 24)
+        for (uint32_t level = 0; level < levels; level++)
+        {
+            if (compressed)
+            {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalformat, levelWidth, levelHeight, 0,
+                                       GetLevelSize(levelWidth, levelHeight), nullptr);
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, level, internalformat, levelWidth, levelHeight, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            }
+
+            levelWidth = max(levelWidth / 2, 1u);
+            levelHeight = max(levelHeight / 2, 1u);
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    storageLevels = levels;
+    storageWidth = width;
+    storageHeight = height;
+    storageFormat = internalformat;
+}
+
+void Texture::SetFormat(TextureFormat textureFormat)
+{
+    this->textureFormat = textureFormat;
+
+    switch (textureFormat)
     {
-        buffer[offset + 2] = color.b;
+    case TextureFormat::DXT1:
+    {
+        internalformat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        bitsPerPixel = 4;
+        compressed = true;
     }
+    break;
 
-    if (bitsPerPixel >= 32)
+    case TextureFormat::DXT1_ONEBITALPHA:
     {
-        buffer[offset + 3] = color.a;
+        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+        bitsPerPixel = 4;
+        compressed = true;
+    }
+    break;
+
+    case TextureFormat::DXT3:
+    {
+        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
+        bitsPerPixel = 8;
+        compressed = true;
+    }
+    break;
+
+    case TextureFormat::DXT5:
+    {
+        internalformat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        bitsPerPixel = 8;
+        compressed = true;
+    }
+    break;
+
+    case TextureFormat::RGB24:
+    {
+        internalformat = GL_RGB8;
+        format = GL_RGB;
+        bitsPerPixel = 24;
+        compressed = false;
+    }
+    break;
+
+    case TextureFormat::RGBA32:
+    {
+        internalformat = GL_RGBA8;
+        format = GL_RGBA;
+        bitsPerPixel = 32;
+        compressed = false;
+    }
+    break;
     }
 }
 
-void Texture::SetPixel(uint32_t x, uint32_t y, const Color &color)
+size_t Texture::GetLevelSize(uint32_t levelWidth, uint32_t levelHeight) const
 {
-    return SetPixel(y * width + x, color);
+    // Compressed formats store whole 4x4 blocks
+    return compressed
+           ? (levelWidth + 3) / 4 * ((levelHeight + 3) / 4) * bitsPerPixel * 2
+           : levelWidth * levelHeight * bitsPerPixel / 8;
 }
 
-void Texture::Allocate(uint32_t newWidth, uint32_t newHeight)
+vector<Texture *> Texture::PackTextures(const vector<Texture *> &textures, vector<AtlasRect> &rects,
+                                       uint32_t maxSize, TextureFormat textureFormat)
 {
-    width = newWidth;
-    height = newHeight;
-    buffer.resize(width * height * bitsPerPixel / 8);
+    vector<uvec2> sizes(textures.size());
+
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+        sizes[i] = uvec2(textures[i]->width, textures[i]->height);
+    }
+
+    auto sizesOfPages = PackRects(sizes, rects, maxSize);
+
+    vector<Texture *> pages(sizesOfPages.size());
+
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+        pages[i] = new Texture(sizesOfPages[i], sizesOfPages[i], textureFormat);
+    }
+
+    for (size_t i = 0; i < textures.size(); i++)
+    {
+        pages[rects[i].page]->Blit(*textures[i], Rect{uvec2(0u), rects[i].rect.size}, rects[i].rect.position);
+    }
+
+    return pages;
 }
 
-vector<Rect> Texture::PackTextures(const vector<Texture *> &textures, uint32_t startW, uint32_t startH)
+vector<uint32_t> Texture::PackRects(const vector<uvec2> &sizes, vector<AtlasRect> &rects, uint32_t maxSize)
 {
-    auto root = new Node;
-    root->rc.position.x = 0;
-    root->rc.position.y = 0;
-    root->rc.size.x = startW;
-    root->rc.size.y = startH;
+    maxSize = maxSize
+              ? min(maxSize, GetMaxSize())
+              : GetMaxSize();
 
-    vector<Rect> rc;
+    // Largest first packs tighter and settles the page size early
+    vector<size_t> remaining(sizes.size());
+    iota(remaining.begin(), remaining.end(), 0);
+    stable_sort(remaining.begin(), remaining.end(), [&](size_t a, size_t b)
+    {
+        return max(sizes[a].x, sizes[a].y) > max(sizes[b].x, sizes[b].y);
+    });
 
-    for (const auto texture : textures)
+    for (auto i : remaining)
     {
-        auto pnode = root->Insert(texture);
+        if (sizes[i].x > maxSize || sizes[i].y > maxSize)
+        {
+            throw logic_error("Texture does not fit into an atlas page");
+        }
+    }
 
-        if (!pnode)
+    rects.assign(sizes.size(), AtlasRect());
+
+    vector<uint32_t> pages;
+    uint32_t size = 0;
+
+    // Every insertion splits a node along both axes, adding up to four
+    // nodes, so one block holds the root and the nodes of a whole attempt,
+    // with room to spare for its header
+    LinearArena nodes((sizes.size() * 4 + 2) * sizeof(Node));
+    vector<size_t> placed, leftover;
+
+    while (!remaining.empty())
+    {
+        if (!size)
         {
-            delete root;
-            return PackTextures(textures,
-                                startW * 2,
-                                startH * 2);
+            size = 1;
 
+            while (size < max(sizes[remaining[0]].x, sizes[remaining[0]].y))
+            {
+                size *= 2;
+            }
+
+            size = min(size, maxSize);
         }
 
-        pnode->used = true;
-        rc.push_back(pnode->rc);
-    }
+        nodes.Reset();
 
-    Allocate(root->rc.size.x, root->rc.size.y);
+        auto root = new (nodes.Allocate(sizeof(Node), alignof(Node))) Node;
+        root->rc = Rect{uvec2(0u), uvec2(size)};
 
-    for (size_t i = 0; i < rc.size(); i++)
-    {
-        for (uint32_t x = 0; x < rc[i].size.x; x++)
+        placed.clear();
+        leftover.clear();
+
+        for (auto i : remaining)
         {
-            for (uint32_t y = 0; y < rc[i].size.y; y++)
+            auto node = root->Insert(sizes[i], nodes);
+
+            if (!node)
             {
-                SetPixel(rc[i].position.x + x,
-                         rc[i].position.y + y,
-                         textures[i]->GetPixel(x, y));
+                leftover.push_back(i);
+                continue;
             }
+
+            node->used = true;
+            rects[i] = AtlasRect{static_cast<uint32_t>(pages.size()), node->rc};
+            placed.push_back(i);
+        }
+
+        // The page grows while it can, only a full sized page spills over
+        // into the next one
+        if (!leftover.empty() && size < maxSize)
+        {
+            size = min(size * 2, maxSize);
+            continue;
         }
+
+        pages.push_back(size);
+        remaining.swap(leftover);
+        size = 0;
     }
 
-    delete root;
-    return rc;
+    return pages;
 }
 
-Texture::Node::~Node()
+uint32_t Texture::GetMaxSize()
 {
-    if (!child[0])
+    static int32_t maxSize;
+
+    if (!maxSize)
     {
-        return;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
     }
 
-    delete child[0];
-    delete child[1];
+    return maxSize;
+}
+
+void Texture::DownsampleBox(const uint8_t *source, uint32_t sourceWidth, uint32_t sourceHeight, uint32_t channels, uint8_t *dest)
+{
+    auto destWidth = max(sourceWidth / 2, 1u);
+    auto destHeight = max(sourceHeight / 2, 1u);
+
+    ThreadPool::ParallelFor(destHeight, [&](size_t begin, size_t end)
+    {
+        for (auto y = begin; y < end; y++)
+        {
+            auto top = source + min<size_t>(y * 2, sourceHeight - 1) * sourceWidth * channels;
+            auto bottom = source + min<size_t>(y * 2 + 1, sourceHeight - 1) * sourceWidth * channels;
+            auto row = dest + y * destWidth * channels;
+            uint32_t x = 0;
+
+#ifdef __SSE2__
+            // Two destination pixels from four source pixels of each row
+            if (channels == 4)
+            {
+                auto zero = _mm_setzero_si128();
+                auto two = _mm_set1_epi16(2);
+
+                for (; x + 1 < destWidth; x += 2)
+                {
+                    auto a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(top + x * 8));
+                    auto b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bottom + x * 8));
+                    auto low = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+                    auto high = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+                    auto sum = _mm_add_epi16(_mm_unpacklo_epi64(low, high), _mm_unpackhi_epi64(low, high));
+
+                    sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                    _mm_storel_epi64(reinterpret_cast<__m128i *>(row + x * 4), _mm_packus_epi16(sum, sum));
+                }
+            }
+#endif
+
+            for (; x < destWidth; x++)
+            {
+                auto left = min(x * 2, sourceWidth - 1) * channels;
+                auto right = min(x * 2 + 1, sourceWidth - 1) * channels;
+
+                for (uint32_t c = 0; c < channels; c++)
+                {
+                    row[x * channels + c] = (top[left + c] + top[right + c] + bottom[left + c] + bottom[right + c] + 2) / 4;
+                }
+            }
+        }
+    });
+}
+
+void Texture::DownsampleKaiser(const uint8_t *source, uint32_t sourceWidth, uint32_t sourceHeight, uint32_t channels, uint8_t *dest)
+{
+    static const auto weights = GetKaiserWeights();
+
+    auto destWidth = max(sourceWidth / 2, 1u);
+    auto destHeight = max(sourceHeight / 2, 1u);
+
+    // Horizontal pass over every source row, then vertical pass
+    vector<float> filtered(destWidth * sourceHeight * channels);
+
+    ThreadPool::ParallelFor(sourceHeight, [&](size_t begin, size_t end)
+    {
+        for (auto y = begin; y < end; y++)
+        {
+            auto row = source + y * sourceWidth * channels;
+            auto out = filtered.data() + y * destWidth * channels;
+
+            for (uint32_t x = 0; x < destWidth; x++)
+            {
+                for (int i = 0; i < 6; i++)
+                {
+                    auto sx = min(static_cast<uint32_t>(max<int64_t>(static_cast<int64_t>(x) * 2 + i - 2, 0)), sourceWidth - 1);
+
+                    for (uint32_t c = 0; c < channels; c++)
+                    {
+                        out[x * channels + c] += row[sx * channels + c] * weights[i];
+                    }
+                }
+            }
+        }
+    });
+
+    ThreadPool::ParallelFor(destHeight, [&](size_t begin, size_t end)
+    {
+        vector<float> sum(destWidth * channels);
+
+        for (auto y = begin; y < end; y++)
+        {
+            fill(sum.begin(), sum.end(), 0.f);
+
+            for (int i = 0; i < 6; i++)
+            {
+                auto sy = min(static_cast<uint32_t>(max<int64_t>(static_cast<int64_t>(y) * 2 + i - 2, 0)), sourceHeight - 1);
+                auto row = filtered.data() + sy * destWidth * channels;
+
+                for (size_t j = 0; j < sum.size(); j++)
+                {
+                    sum[j] += row[j] * weights[i];
+                }
+            }
+
+            auto out = dest + y * destWidth * channels;
+
+            // Negative lobes can overshoot
+            for (size_t j = 0; j < sum.size(); j++)
+            {
+                out[j] = static_cast<uint8_t>(min(max(sum[j] + .5f, 0.f), 255.f));
+            }
+        }
+    });
 }
 
-Texture::Node *Texture::Node::Insert(const Texture *texture)
+Texture::Node *Texture::Node::Insert(const uvec2 &size, LinearArena &arena)
 {
     if (child[0])
     {
-        auto newNode = child[0]->Insert(texture);
+        auto newNode = child[0]->Insert(size, arena);
         return newNode
                ? newNode
-               : child[1]->Insert(texture);
+               : child[1]->Insert(size, arena);
     }
 
     if (used)
@@ -288,8 +890,8 @@ Texture::Node *Texture::Node::Insert(const Texture *texture)
         return nullptr;
     }
 
-    int32_t dw = rc.size.x - texture->width;
-    int32_t dh = rc.size.y - texture->height;
+    int32_t dw = rc.size.x - size.x;
+    int32_t dh = rc.size.y - size.y;
 
     if (dw < 0 || dh < 0)
     {
@@ -301,31 +903,31 @@ Texture::Node *Texture::Node::Insert(const Texture *texture)
         return this;
     }
 
-    child[0] = new Node;
-    child[1] = new Node;
+    child[0] = new (arena.Allocate(sizeof(Node), alignof(Node))) Node;
+    child[1] = new (arena.Allocate(sizeof(Node), alignof(Node))) Node;
 
     if (dw > dh)
     {
         child[0]->rc.position = rc.position;
-        child[0]->rc.size.x = texture->width;
+        child[0]->rc.size.x = size.x;
         child[0]->rc.size.y = rc.size.y;
 
-        child[1]->rc.position.x = rc.position.x + texture->width;
+        child[1]->rc.position.x = rc.position.x + size.x;
         child[1]->rc.position.y = rc.position.y;
-        child[1]->rc.size.x = rc.size.x - texture->width;
+        child[1]->rc.size.x = rc.size.x - size.x;
         child[1]->rc.size.y = rc.size.y;
     }
     else
     {
         child[0]->rc.position = rc.position;
         child[0]->rc.size.x = rc.size.x;
-        child[0]->rc.size.y = texture->height;
+        child[0]->rc.size.y = size.y;
 
         child[1]->rc.position.x = rc.position.x;
-        child[1]->rc.position.y = rc.position.y + texture->height;
+        child[1]->rc.position.y = rc.position.y + size.y;
         child[1]->rc.size.x = rc.size.x;
-        child[1]->rc.size.y = rc.size.y - texture->height;
+        child[1]->rc.size.y = rc.size.y - size.y;
     }
 
-    return child[0]->Insert(texture);
+    return child[0]->Insert(size, arena);
 }
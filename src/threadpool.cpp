@@ -0,0 +1,362 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+using std::exception_ptr;
+using std::function;
+using std::lock_guard;
+using std::logic_error;
+using std::max;
+using std::min;
+using std::mutex;
+using std::thread;
+using std::unique_lock;
+using std::vector;
+
+// Queue of the calling thread, threads outside the pool share the one of
+// the main thread
+static thread_local size_t current;
+
+JobCounter::JobCounter()
+    : count(0)
+{
+}
+
+bool JobCounter::IsDone() const
+{
+    return count == 0;
+}
+
+ThreadPool::ThreadPool()
+    : queues(max(thread::hardware_concurrency(), 1u))
+    , mainThread(std::this_thread::get_id())
+    , pending(0)
+    , mainThreadPending(0)
+    , stopping(false)
+{
+    for (size_t i = 1; i < queues.size(); i++)
+    {
+        threads.emplace_back(&ThreadPool::Work, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        stopping = true;
+    }
+
+    condition.notify_all();
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount()
+{
+    return Instance().queues.size();
+}
+
+bool ThreadPool::IsMainThread()
+{
+    return std::this_thread::get_id() == Instance().mainThread;
+}
+
+void ThreadPool::Run(const function<void()> &function, JobCounter *counter, JobCounter *dependency)
+{
+    auto &pool = Instance();
+
+    if (counter)
+    {
+        counter->count++;
+    }
+
+    Job job{function, counter};
+
+    if (dependency)
+    {
+        lock_guard<mutex> lock(dependency->mutex);
+
+        if (dependency->count)
+        {
+            dependency->waiting.push_back(std::move(job));
+            return;
+        }
+    }
+
+    pool.Schedule(std::move(job));
+}
+
+void ThreadPool::Wait(const JobCounter &counter)
+{
+    auto &pool = Instance();
+    auto isMainThread = IsMainThread();
+
+    while (!counter.IsDone())
+    {
+        if ((isMainThread && pool.RunMainThreadJob()) || pool.RunPending())
+        {
+            continue;
+        }
+
+        unique_lock<mutex> lock(pool.sleepMutex);
+        pool.condition.wait(lock, [&]
+        {
+            return counter.IsDone() || pool.pending || (isMainThread && pool.mainThreadPending);
+        });
+    }
+
+    // The last job may still hold the lock, the counter can only go away
+    // once it has let go
+    lock_guard<mutex> lock(counter.mutex);
+}
+
+void ThreadPool::ParallelFor(size_t count, const function<void(size_t, size_t)> &body)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    auto chunks = min(count, GetThreadCount());
+
+    if (chunks == 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    JobCounter counter;
+    mutex errorMutex;
+    exception_ptr error;
+
+    auto run = [&](size_t begin, size_t end)
+    {
+        try
+        {
+            body(begin, end);
+        }
+        catch (...)
+        {
+            lock_guard<mutex> lock(errorMutex);
+
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    for (size_t i = 1; i < chunks; i++)
+    {
+        auto begin = count * i / chunks;
+        auto end = count * (i + 1) / chunks;
+        Run([&run, begin, end] { run(begin, end); }, &counter);
+    }
+
+    run(0, count / chunks);
+
+    // Help with queued work instead of sleeping, so nested calls from
+    // worker threads cannot starve the pool
+    Wait(counter);
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::RunOnMainThread(const function<void()> &function, JobCounter *counter)
+{
+    auto &pool = Instance();
+
+    if (counter)
+    {
+        counter->count++;
+    }
+
+    {
+        lock_guard<mutex> lock(pool.mainThreadJobs.mutex);
+        pool.mainThreadPending++;
+        pool.mainThreadJobs.jobs.push_back(Job{function, counter});
+    }
+
+    pool.Wake();
+}
+
+void ThreadPool::RunMainThreadJobs()
+{
+    if (!IsMainThread())
+    {
+        throw logic_error("Main thread jobs can only be run from the main thread");
+    }
+
+    auto &pool = Instance();
+
+    // Jobs queued meanwhile wait for the next call
+    for (auto count = pool.mainThreadPending.load(); count && pool.RunMainThreadJob(); count--)
+    {
+    }
+}
+
+ThreadPool &ThreadPool::Instance()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::Schedule(Job &&job)
+{
+    // Nobody else would ever run it
+    if (threads.empty())
+    {
+        job.function();
+        Finish(job.counter);
+        return;
+    }
+
+    // Counted first, so that the hint never drops below the actual count
+    pending++;
+
+    {
+        auto &queue = queues[current];
+        lock_guard<mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    Wake();
+}
+
+void ThreadPool::Finish(JobCounter *counter)
+{
+    if (!counter)
+    {
+        return;
+    }
+
+    vector<Job> released;
+
+    {
+        lock_guard<mutex> lock(counter->mutex);
+
+        if (--counter->count)
+        {
+            return;
+        }
+
+        released.swap(counter->waiting);
+    }
+
+    for (auto &job : released)
+    {
+        Schedule(std::move(job));
+    }
+
+    // Threads waiting for the counter sleep until something happens
+    Wake();
+}
+
+bool ThreadPool::RunPending()
+{
+    Job job{};
+    auto found = false;
+
+    // The newest job of the own queue is the most likely to be in cache
+    {
+        auto &queue = queues[current];
+        lock_guard<mutex> lock(queue.mutex);
+
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.back());
+            queue.jobs.pop_back();
+            found = true;
+        }
+    }
+
+    // Otherwise take the oldest job of another thread, the largest share
+    // of work left there
+    for (size_t i = 1; i < queues.size() && !found; i++)
+    {
+        auto &queue = queues[(current + i) % queues.size()];
+        lock_guard<mutex> lock(queue.mutex);
+
+        if (!queue.jobs.empty())
+        {
+            job = std::move(queue.jobs.front());
+            queue.jobs.pop_front();
+            found = true;
+        }
+    }
+
+    if (!found)
+    {
+        return false;
+    }
+
+    pending--;
+    job.function();
+    Finish(job.counter);
+    return true;
+}
+
+bool ThreadPool::RunMainThreadJob()
+{
+    Job job{};
+
+    {
+        lock_guard<mutex> lock(mainThreadJobs.mutex);
+
+        if (mainThreadJobs.jobs.empty())
+        {
+            return false;
+        }
+
+        job = std::move(mainThreadJobs.jobs.front());
+        mainThreadJobs.jobs.pop_front();
+        mainThreadPending--;
+    }
+
+    job.function();
+    Finish(job.counter);
+    return true;
+}
+
+void ThreadPool::Wake()
+{
+    // Taking the lock orders the change with the check of a thread about
+    // to sleep
+    {
+        lock_guard<mutex> lock(sleepMutex);
+    }
+
+    condition.notify_all();
+}
+
+void ThreadPool::Work(size_t index)
+{
+    current = index;
+
+    while (true)
+    {
+        if (RunPending())
+        {
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleepMutex);
+        condition.wait(lock, [this]
+        {
+            return stopping || pending;
+        });
+
+        if (stopping)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,296 @@
+#include "transformstorage.h"
+#include "threadpool.h"
+
+using glm::mat4;
+using glm::mat4_cast;
+using glm::quat;
+using glm::vec3;
+using glm::vec4;
+
+#include <stdexcept>
+using std::logic_error;
+using std::vector;
+
+// Levels smaller than this are not worth handing to the thread pool
+constexpr size_t ParallelLevelSize = 4096;
+
+// Dirty flag values
+constexpr uint8_t Clean = 0;
+constexpr uint8_t Changed = 1;
+constexpr uint8_t SubtreeRoot = 2;
+
+constexpr uint32_t TransformStorage::None;
+
+vector<vec3> TransformStorage::positions;
+vector<quat> TransformStorage::rotations;
+vector<vec3> TransformStorage::scales;
+vector<mat4> TransformStorage::worlds;
+vector<uint32_t> TransformStorage::parents;
+vector<uint32_t> TransformStorage::firstChildren;
+vector<uint32_t> TransformStorage::nextSiblings;
+vector<uint32_t> TransformStorage::previousSiblings;
+vector<uint32_t> TransformStorage::depths;
+vector<uint8_t> TransformStorage::dirty;
+vector<uint32_t> TransformStorage::freeSlots;
+vector<uint32_t> TransformStorage::dirtySlots;
+vector<vector<uint32_t>> TransformStorage::levels;
+vector<uint32_t> TransformStorage::updated;
+vector<uint32_t> TransformStorage::stack;
+
+uint32_t TransformStorage::Allocate()
+{
+    uint32_t slot;
+
+    if (freeSlots.empty())
+    {
+        slot = worlds.size();
+
+        positions.emplace_back();
+        rotations.emplace_back();
+        scales.emplace_back();
+        worlds.emplace_back();
+        parents.emplace_back();
+        firstChildren.emplace_back();
+        nextSiblings.emplace_back();
+        previousSiblings.emplace_back();
+        depths.emplace_back();
+        dirty.emplace_back();
+    }
+    else
+    {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
+    }
+
+    positions[slot] = vec3(0.f);
+    rotations[slot] = quat(1.f, 0.f, 0.f, 0.f);
+    scales[slot] = vec3(1.f);
+    worlds[slot] = mat4(1.f);
+    parents[slot] = None;
+    firstChildren[slot] = None;
+    nextSiblings[slot] = None;
+    previousSiblings[slot] = None;
+    depths[slot] = 0;
+    dirty[slot] = Clean;
+
+    return slot;
+}
+
+void TransformStorage::Free(uint32_t slot)
+{
+    Detach(slot);
+
+    // Children are left at the top of the hierarchy
+    for (auto child = firstChildren[slot]; child != None;)
+    {
+        auto next = nextSiblings[child];
+
+        parents[child] = None;
+        nextSiblings[child] = None;
+        previousSiblings[child] = None;
+        SetDepth(child, 0);
+        MarkDirty(child);
+
+        child = next;
+    }
+
+    firstChildren[slot] = None;
+    dirty[slot] = Clean;
+    freeSlots.push_back(slot);
+}
+
+void TransformStorage::SetParent(uint32_t slot, uint32_t parent)
+{
+    for (auto ancestor = parent; ancestor != None; ancestor = parents[ancestor])
+    {
+        if (ancestor == slot)
+        {
+            throw logic_error("An object cannot be parented to itself or its descendants");
+        }
+    }
+
+    Detach(slot);
+
+    if (parent != None)
+    {
+        parents[slot] = parent;
+        nextSiblings[slot] = firstChildren[parent];
+
+        if (firstChildren[parent] != None)
+        {
+            previousSiblings[firstChildren[parent]] = slot;
+        }
+
+        firstChildren[parent] = slot;
+    }
+
+    SetDepth(slot, parent != None ? depths[parent] + 1 : 0);
+    MarkDirty(slot);
+}
+
+void TransformStorage::MarkDirty(uint32_t slot)
+{
+    if (dirty[slot] == Clean)
+    {
+        dirty[slot] = Changed;
+        dirtySlots.push_back(slot);
+    }
+}
+
+void TransformStorage::Update()
+{
+    // A changed slot below another changed slot is covered by the
+    // ancestor's subtree. Slots freed and reused since the last update
+    // may be listed twice, the flag keeps them from being taken twice.
+    auto count = 0;
+
+    for (auto slot : dirtySlots)
+    {
+        if (dirty[slot] != Changed)
+        {
+            continue;
+        }
+
+        auto covered = false;
+
+        for (auto ancestor = parents[slot]; ancestor != None && !covered; ancestor = parents[ancestor])
+        {
+            covered = dirty[ancestor] != Clean;
+        }
+
+        if (!covered)
+        {
+            dirty[slot] = SubtreeRoot;
+            dirtySlots[count++] = slot;
+        }
+    }
+
+    dirtySlots.resize(count);
+
+    // Buckets every slot of the dirty subtrees by depth
+    for (auto root : dirtySlots)
+    {
+        stack.push_back(root);
+
+        while (!stack.empty())
+        {
+            auto slot = stack.back();
+            stack.pop_back();
+
+            if (levels.size() <= depths[slot])
+            {
+                levels.resize(depths[slot] + 1);
+            }
+
+            levels[depths[slot]].push_back(slot);
+            dirty[slot] = Clean;
+
+            for (auto child = firstChildren[slot]; child != None; child = nextSiblings[child])
+            {
+                stack.push_back(child);
+            }
+        }
+    }
+
+    dirtySlots.clear();
+    updated.clear();
+
+    for (auto &level : levels)
+    {
+        auto process = [&](size_t begin, size_t end)
+        {
+            for (auto i = begin; i < end; i++)
+            {
+                auto slot = level[i];
+
+                worlds[slot] = parents[slot] != None
+                               ? worlds[parents[slot]] * GetLocalMatrix(slot)
+                               : GetLocalMatrix(slot);
+            }
+        };
+
+        if (level.size() >= ParallelLevelSize)
+        {
+            ThreadPool::ParallelFor(level.size(), process);
+        }
+        else
+        {
+            process(0, level.size());
+        }
+
+        updated.insert(updated.end(), level.begin(), level.end());
+        level.clear();
+    }
+}
+
+size_t TransformStorage::GetCount()
+{
+    return worlds.size() - freeSlots.size();
+}
+
+const mat4 &TransformStorage::GetWorldMatrix(uint32_t slot)
+{
+    return worlds[slot];
+}
+
+const vector<uint32_t> &TransformStorage::GetUpdated()
+{
+    return updated;
+}
+
+void TransformStorage::Detach(uint32_t slot)
+{
+    if (parents[slot] == None)
+    {
+        return;
+    }
+
+    if (previousSiblings[slot] != None)
+    {
+        nextSiblings[previousSiblings[slot]] = nextSiblings[slot];
+    }
+    else
+    {
+        firstChildren[parents[slot]] = nextSiblings[slot];
+    }
+
+    if (nextSiblings[slot] != None)
+    {
+        previousSiblings[nextSiblings[slot]] = previousSiblings[slot];
+    }
+
+    nextSiblings[slot] = None;
+    previousSiblings[slot] = None;
+    parents[slot] = None;
+}
+
+void TransformStorage::SetDepth(uint32_t slot, uint32_t depth)
+{
+    stack.assign(1, slot);
+    depths[slot] = depth;
+
+    while (!stack.empty())
+    {
+        auto parent = stack.back();
+        stack.pop_back();
+
+        for (auto child = firstChildren[parent]; child != None; child = nextSiblings[child])
+        {
+            depths[child] = depths[parent] + 1;
+            stack.push_back(child);
+        }
+    }
+}
+
+mat4 TransformStorage::GetLocalMatrix(uint32_t slot)
+{
+    // Translation * rotation * scale, without the three matrix products
+    auto local = mat4_cast(rotations[slot]);
+
+    local[0] *= scales[slot].x;
+    local[1] *= scales[slot].y;
+    local[2] *= scales[slot].z;
+    local[3] = vec4(positions[slot], 1.f);
+
+    return local;
+}